@@ -0,0 +1,440 @@
+// End-to-end Patcher run over synthetic PE and ELF images: load, scan and export for a range of
+// thread counts, checking every exported value against where it was planted.
+//
+// Usage: patcher [text_mb = 64] [num_scans = 400] [output = patcher.json]
+//
+// Each image has a code section of `text_mb` and a read-only data section of a quarter of that,
+// filled with seeded random bytes that never contain 0xF1. Every scan gets a site of its own,
+// F1 F1 <id> <payload>, so its signature matches exactly once. Half of the scans go to each image.
+// Peak RSS is that of the process so far, so it only grows from one run to the next.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+// Redefinition guard
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <fmt/format.h>
+
+#include "oph/offset-table.hpp"
+#include "oph/patcher.hpp"
+#include "oph/sig-scan.hpp"
+
+using namespace oph;
+
+constexpr uint64_t kSeed = 0x6F7068;
+constexpr size_t kRepeats = 3;
+constexpr uint8_t kMarker = 0xF1;
+constexpr size_t kSiteSize = 10;  // F1 F1, 4-byte id, 4-byte payload
+
+// Where the builder put the sections of an image, relative to its base.
+struct ImageLayout {
+  std::string module_name;
+  std::string text_name;
+  std::string data_name;
+  uint64_t image_base;
+  uint64_t text_rva;
+  uint64_t data_rva;
+};
+
+struct Site {
+  bool in_text;
+  uint64_t offset;  // In its section.
+  uint32_t id;
+  uint32_t payload;
+};
+
+struct Expected {
+  bool is_bytes;
+  uint64_t offset;
+  std::vector<uint8_t> bytes;
+};
+
+template <typename T>
+void Put(std::vector<uint8_t>& file, uint64_t offset, T value) {
+  std::memcpy(file.data() + offset, &value, sizeof(T));
+}
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Seeded random bytes without the marker, with `sites` written over them.
+std::vector<uint8_t> MakeSectionData(std::mt19937_64& rng, size_t size, bool text, const std::vector<Site>& sites) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; i += 8) {
+    uint64_t value = rng();
+    for (size_t j = 0; j < 8 && i + j < size; j++) {
+      uint8_t byte = (uint8_t)(value >> (j * 8));
+      data[i + j] = byte == kMarker ? 0 : byte;
+    }
+  }
+  for (const auto& site : sites) {
+    if (site.in_text == text) {
+      data[site.offset] = kMarker;
+      data[site.offset + 1] = kMarker;
+      std::memcpy(&data[site.offset + 2], &site.id, 4);
+      std::memcpy(&data[site.offset + 6], &site.payload, 4);
+    }
+  }
+  return data;
+}
+
+std::vector<uint8_t> BuildPE(const std::vector<uint8_t>& text, const std::vector<uint8_t>& data, ImageLayout& layout) {
+  constexpr uint64_t kFileAlignment = 0x200;
+  constexpr uint64_t kSectionAlignment = 0x1000;
+  constexpr uint64_t kHeadersSize = 0x400;
+
+  layout.image_base = 0x140000000;
+  layout.text_rva = kSectionAlignment;
+  layout.data_rva = AlignUp(layout.text_rva + text.size(), kSectionAlignment);
+  uint64_t text_raw = kHeadersSize;
+  uint64_t data_raw = AlignUp(text_raw + text.size(), kFileAlignment);
+  std::vector<uint8_t> file(AlignUp(data_raw + data.size(), kFileAlignment));
+
+  // DOS header, then the PE32+ headers right after it: signature, file header, optional header
+  constexpr uint64_t kNtOffset = 0x40;
+  constexpr uint64_t kOptionalOffset = kNtOffset + 4 + 20;
+  constexpr uint16_t kOptionalSize = 0xF0;
+  Put<uint16_t>(file, 0, 0x5A4D);  // MZ
+  Put<uint32_t>(file, 0x3C, kNtOffset);
+  Put<uint32_t>(file, kNtOffset, 0x4550);       // PE\0\0
+  Put<uint16_t>(file, kNtOffset + 4, 0x8664);   // AMD64
+  Put<uint16_t>(file, kNtOffset + 6, 2);
+  Put<uint16_t>(file, kNtOffset + 20, kOptionalSize);
+  Put<uint16_t>(file, kOptionalOffset, 0x20B);  // PE32+
+  Put<uint64_t>(file, kOptionalOffset + 24, layout.image_base);
+  Put<uint32_t>(file, kOptionalOffset + 32, kSectionAlignment);
+  Put<uint32_t>(file, kOptionalOffset + 36, kFileAlignment);
+  Put<uint32_t>(file, kOptionalOffset + 56, AlignUp(layout.data_rva + data.size(), kSectionAlignment));
+  Put<uint32_t>(file, kOptionalOffset + 60, kHeadersSize);
+
+  auto section = [&](uint16_t index, const char* name, uint64_t rva, uint64_t raw, size_t size, uint32_t characteristics) {
+    uint64_t header = kOptionalOffset + kOptionalSize + index * 40;
+    std::memcpy(file.data() + header, name, std::strlen(name));
+    Put<uint32_t>(file, header + 8, size);
+    Put<uint32_t>(file, header + 12, rva);
+    Put<uint32_t>(file, header + 16, AlignUp(size, kFileAlignment));
+    Put<uint32_t>(file, header + 20, raw);
+    Put<uint32_t>(file, header + 36, characteristics);
+  };
+  section(0, ".text", layout.text_rva, text_raw, text.size(), 0x60000020);  // CODE, EXECUTE, READ
+  section(1, ".rdata", layout.data_rva, data_raw, data.size(), 0x40000000);  // READ
+
+  std::memcpy(file.data() + text_raw, text.data(), text.size());
+  std::memcpy(file.data() + data_raw, data.data(), data.size());
+  layout.text_name = ".text";
+  layout.data_name = ".rdata";
+  return file;
+}
+
+// ELF64 executable with the headers, .text and .rodata each in a loadable segment, plus a section
+// header table so the sections can be found by name.
+std::vector<uint8_t> BuildELF(const std::vector<uint8_t>& text, const std::vector<uint8_t>& data, ImageLayout& layout) {
+  constexpr uint64_t kPageSize = 0x1000;
+  constexpr uint16_t kNumSegments = 3;
+  constexpr uint16_t kNumSections = 4;  // null, .text, .rodata, .shstrtab
+  constexpr char kNames[] = "\0.text\0.rodata\0.shstrtab";
+
+  layout.image_base = 0x400000;
+  layout.text_rva = kPageSize;
+  layout.data_rva = AlignUp(layout.text_rva + text.size(), kPageSize);
+  uint64_t names_offset = layout.data_rva + data.size();
+  uint64_t sh_offset = AlignUp(names_offset + sizeof(kNames), 8);
+  std::vector<uint8_t> file(sh_offset + kNumSections * 0x40);
+
+  // e_ident: ELF64, little-endian, version 1
+  const uint8_t ident[] = {0x7F, 'E', 'L', 'F', 2, 1, 1};
+  std::memcpy(file.data(), ident, sizeof(ident));
+  Put<uint16_t>(file, 0x10, 2);  // ET_EXEC
+  Put<uint16_t>(file, 0x12, 0x3E);  // EM_X86_64
+  Put<uint32_t>(file, 0x14, 1);
+  Put<uint64_t>(file, 0x18, layout.image_base + layout.text_rva);
+  Put<uint64_t>(file, 0x20, 0x40);
+  Put<uint64_t>(file, 0x28, sh_offset);
+  Put<uint16_t>(file, 0x34, 0x40);
+  Put<uint16_t>(file, 0x36, 0x38);
+  Put<uint16_t>(file, 0x38, kNumSegments);
+  Put<uint16_t>(file, 0x3A, 0x40);
+  Put<uint16_t>(file, 0x3C, kNumSections);
+  Put<uint16_t>(file, 0x3E, kNumSections - 1);
+
+  // File offsets equal RVAs, so every segment and section is at image_base + its offset.
+  auto segment = [&](uint16_t index, uint32_t flags, uint64_t offset, uint64_t size) {
+    uint64_t header = 0x40 + index * 0x38;
+    Put<uint32_t>(file, header, 1);  // PT_LOAD
+    Put<uint32_t>(file, header + 0x04, flags);
+    Put<uint64_t>(file, header + 0x08, offset);
+    Put<uint64_t>(file, header + 0x10, layout.image_base + offset);
+    Put<uint64_t>(file, header + 0x18, layout.image_base + offset);
+    Put<uint64_t>(file, header + 0x20, size);
+    Put<uint64_t>(file, header + 0x28, size);
+    Put<uint64_t>(file, header + 0x30, kPageSize);
+  };
+  segment(0, 4, 0, 0x40 + kNumSegments * 0x38);  // R
+  segment(1, 5, layout.text_rva, text.size());    // R+X
+  segment(2, 4, layout.data_rva, data.size());    // R
+
+  auto section = [&](uint16_t index, uint32_t name, uint32_t type, uint64_t flags, uint64_t addr, uint64_t offset, uint64_t size) {
+    uint64_t header = sh_offset + index * 0x40;
+    Put<uint32_t>(file, header, name);
+    Put<uint32_t>(file, header + 0x04, type);
+    Put<uint64_t>(file, header + 0x08, flags);
+    Put<uint64_t>(file, header + 0x10, addr);
+    Put<uint64_t>(file, header + 0x18, offset);
+    Put<uint64_t>(file, header + 0x20, size);
+  };
+  section(1, 1, 1, 0x6, layout.image_base + layout.text_rva, layout.text_rva, text.size());  // PROGBITS, ALLOC+EXEC
+  section(2, 7, 1, 0x2, layout.image_base + layout.data_rva, layout.data_rva, data.size());  // PROGBITS, ALLOC
+  section(3, 15, 3, 0, 0, names_offset, sizeof(kNames));                                   // STRTAB
+
+  std::memcpy(file.data() + layout.text_rva, text.data(), text.size());
+  std::memcpy(file.data() + layout.data_rva, data.data(), data.size());
+  std::memcpy(file.data() + names_offset, kNames, sizeof(kNames));
+  layout.text_name = ".text";
+  layout.data_name = ".rodata";
+  return file;
+}
+
+std::string SiteSig(const Site& site) {
+  std::string sig = "F1 F1";
+  for (int i = 0; i < 4; i++) {
+    sig += fmt::format(" {:02X}", (site.id >> (i * 8)) & 0xFF);
+  }
+  return sig + " ? ? ? ?";
+}
+
+// Scans of one image, one per site, cycling through the kinds of scans a real script has: fused
+// SigScans of either section, byte reads and offsets that depend on a named scan, and plain scan
+// functions that search a section on their own.
+void AddScript(Patcher& patcher, const ImageLayout& layout, const std::vector<Site>& sites, std::vector<Expected>& expected) {
+  const auto& module = layout.module_name;
+  patcher.WriteModule(module);
+  for (size_t i = 0; i < sites.size(); i++) {
+    const Site& site = sites[i];
+    std::string name = fmt::format("{}_{:04}", module, i);
+    uint64_t rva = (site.in_text ? layout.text_rva : layout.data_rva) + site.offset;
+    std::vector<uint8_t> payload(kSiteSize - 6);
+    std::memcpy(payload.data(), &site.payload, payload.size());
+
+    switch (i % 8) {
+      case 0:
+      case 1:
+      case 2:
+      case 3:
+        patcher.WriteOffset(name, SigScan(module, layout.text_name, SigExpr(SiteSig(site))).Add(i % 2 * 6).ToRVA());
+        expected.push_back({false, rva + i % 2 * 6, {}});
+        break;
+      case 4:
+        patcher.DefineScan(name + "_SITE", SigScan(module, layout.text_name, SigExpr(SiteSig(site))));
+        patcher.WriteBytes(name, {name + "_SITE"}, [module, section = layout.text_name](const DumpStore& store, std::span<const uint64_t> values) {
+          auto dump = store.GetSection(module, section).GetDump().subspan(values[0] + 6, kSiteSize - 6);
+          return std::vector<uint8_t>(dump.begin(), dump.end());
+        });
+        expected.push_back({true, 0, payload});
+        break;
+      case 5:
+        patcher.WriteOffset(name, SigScan(module, layout.data_name, SigExpr(SiteSig(site))).ToVA());
+        expected.push_back({false, layout.image_base + rva, {}});
+        break;
+      case 6:
+        patcher.WriteOffset(name, [module, section = layout.data_name, sig = SigExpr(SiteSig(site))](const DumpStore& store, std::stop_token stoken) {
+          const auto& data = store.GetSection(module, section);
+          return sig.Search(data.GetDump(), stoken, 1, 0) + data.GetRVA();
+        });
+        expected.push_back({false, rva, {}});
+        break;
+      case 7:
+        // Without a ToVA or ToRVA step, a named scan is the offset in its section.
+        patcher.WriteOffset(name, {fmt::format("{}_{:04}_SITE", module, i - 3)}, [](const DumpStore&, std::span<const uint64_t> values) { return values[0] + kSiteSize; });
+        expected.push_back({false, sites[i - 3].offset + kSiteSize, {}});
+        break;
+    }
+  }
+  patcher.WriteLineBreak();
+}
+
+size_t GetPeakRss() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+  rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss * 1024 : 0;
+#endif
+}
+
+// Number of mismatches between the binary export and `expected`.
+size_t Verify(const std::string& table_data, const std::vector<Expected>& expected) {
+  OffsetTable table(std::span<const uint8_t>((const uint8_t*)table_data.data(), table_data.size()));
+  auto entries = table.GetEntries();
+  if (entries.size() != expected.size()) {
+    return expected.size();
+  }
+
+  size_t num_mismatches = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const auto& entry = entries[i];
+    bool ok = entry.status == OffsetTableEntry::kOk;
+    if (ok && expected[i].is_bytes) {
+      auto bytes = table.GetBytes(entry);
+      ok = std::ranges::equal(bytes, expected[i].bytes);
+    } else if (ok) {
+      ok = entry.type == OffsetTableEntry::kOffset && entry.value == expected[i].offset;
+    }
+    if (!ok) {
+      std::cerr << fmt::format("mismatch: {}\n", table.GetName(entry));
+      num_mismatches++;
+    }
+  }
+  return num_mismatches;
+}
+
+struct Result {
+  size_t num_threads;
+  double dump_seconds;
+  double scan_seconds;
+  double export_seconds;
+  size_t peak_rss;
+  size_t num_mismatches;
+};
+
+double Seconds(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+// Loads the images, scans and exports in every format; the times are the best of kRepeats runs.
+Result Run(size_t num_threads, const std::vector<std::pair<std::string, ImageLayout>>& images,
+           const std::vector<std::vector<Site>>& sites) {
+  Result result{num_threads, 1e300, 1e300, 1e300, 0, 0};
+  for (size_t repeat = 0; repeat < kRepeats; repeat++) {
+    Patcher patcher(Patcher::kBinary, num_threads);
+    std::vector<Expected> expected;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (const auto& [file_path, layout] : images) {
+      patcher.LoadModule(layout.module_name, file_path, "1.0.0.0");
+    }
+    auto loaded = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < images.size(); i++) {
+      AddScript(patcher, images[i].second, sites[i], expected);
+    }
+    std::ostringstream table;
+    patcher.Export(table);
+    auto scanned = std::chrono::steady_clock::now();
+
+    // The results are kept, so these only format.
+    std::ostringstream cpp, json, binary;
+    patcher.Export(cpp, Patcher::kCpp);
+    patcher.Export(json, Patcher::kJson);
+    patcher.Export(binary, Patcher::kBinary);
+    auto exported = std::chrono::steady_clock::now();
+
+    result.dump_seconds = std::min(result.dump_seconds, Seconds(begin, loaded));
+    result.scan_seconds = std::min(result.scan_seconds, Seconds(loaded, scanned));
+    result.export_seconds = std::min(result.export_seconds, Seconds(scanned, exported));
+    result.num_mismatches += Verify(table.str(), expected) + (binary.str() != table.str());
+  }
+  result.peak_rss = GetPeakRss();
+  return result;
+}
+
+int main(int argc, char** argv) {
+  size_t text_size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64) << 20;
+  size_t num_scans = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 400;
+  std::string output = argc > 3 ? argv[3] : "patcher.json";
+  size_t data_size = text_size / 4;
+
+  // Sites are spread evenly over their section. Scans 5 and 6 of every 8 read the data section.
+  std::mt19937_64 rng(kSeed);
+  std::vector<std::pair<std::string, ImageLayout>> images;
+  std::vector<std::vector<Site>> sites;
+  auto temp_dir = std::filesystem::temp_directory_path();
+  for (size_t image = 0; image < 2; image++) {
+    size_t num_sites = num_scans / 2;
+    auto in_text = [](size_t i) { return i % 8 != 5 && i % 8 != 6; };
+    size_t num_text_sites = 0;
+    for (size_t i = 0; i < num_sites; i++) {
+      num_text_sites += in_text(i);
+    }
+    size_t num_data_sites = num_sites - num_text_sites;
+    size_t text_index = 0, data_index = 0;
+
+    std::vector<Site> image_sites;
+    for (size_t i = 0; i < num_sites; i++) {
+      uint64_t offset = in_text(i) ? (text_size - kSiteSize) * text_index++ / num_text_sites
+                                   : (data_size - kSiteSize) * data_index++ / num_data_sites;
+      image_sites.push_back({in_text(i), offset, (uint32_t)(image << 24 | i), (uint32_t)rng()});
+    }
+
+    auto text = MakeSectionData(rng, text_size, true, image_sites);
+    auto data = MakeSectionData(rng, data_size, false, image_sites);
+    ImageLayout layout;
+    std::vector<uint8_t> file;
+    if (image == 0) {
+      layout.module_name = "bench.exe";
+      file = BuildPE(text, data, layout);
+    } else {
+      layout.module_name = "bench.so";
+      file = BuildELF(text, data, layout);
+    }
+
+    auto file_path = (temp_dir / layout.module_name).string();
+    std::ofstream(file_path, std::ios::binary).write((const char*)file.data(), file.size());
+    images.emplace_back(file_path, layout);
+    sites.push_back(std::move(image_sites));
+  }
+
+  std::vector<size_t> thread_counts;
+  size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  for (size_t num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  std::cout << fmt::format("images: PE and ELF, .text {:.1f} MB, data {:.1f} MB, {} scans\n\n", text_size / 1048576.0, data_size / 1048576.0, num_scans);
+  std::cout << fmt::format("{:>8} {:>10} {:>10} {:>12} {:>9} {:>14} {:>10}\n", "threads", "dump(ms)", "scan(ms)", "export(ms)", "speedup", "peak_rss(MB)", "mismatches");
+
+  std::vector<Result> results;
+  for (size_t num_threads : thread_counts) {
+    auto result = Run(num_threads, images, sites);
+    double speedup = results.empty() ? 1.0 : results.front().scan_seconds / result.scan_seconds;
+    std::cout << fmt::format("{:>8} {:>10.1f} {:>10.1f} {:>12.2f} {:>8.2f}x {:>14.1f} {:>10}\n", num_threads, result.dump_seconds * 1e3,
+                             result.scan_seconds * 1e3, result.export_seconds * 1e3, speedup, result.peak_rss / 1048576.0, result.num_mismatches);
+    results.push_back(result);
+  }
+
+  std::ofstream file(output);
+  file << fmt::format("{{\"text_bytes\":{},\"data_bytes\":{},\"num_scans\":{},\"results\":[", text_size, data_size, num_scans);
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    file << fmt::format("{}\n{{\"num_threads\":{},\"dump_seconds\":{:.6f},\"scan_seconds\":{:.6f},\"export_seconds\":{:.6f},\"peak_rss_bytes\":{},\"mismatches\":{}}}",
+                        i == 0 ? "" : ",", result.num_threads, result.dump_seconds, result.scan_seconds, result.export_seconds, result.peak_rss, result.num_mismatches);
+  }
+  file << "\n]}\n";
+  std::cout << fmt::format("\nwritten to {}\n", output);
+
+  for (const auto& [file_path, layout] : images) {
+    std::filesystem::remove(file_path);
+  }
+  bool failed = std::ranges::any_of(results, [](const Result& result) { return result.num_mismatches != 0; });
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,366 @@
+// Throughput of SigExpr and Decoder over synthetic x86-64 code, from 1 MB to 1 GB.
+//
+// Usage: scan [max_corpus_mb = 1024] [output = scan.json]
+//
+// The corpus is a stream of functions (prologue, random body, epilogue, int3 padding) encoded from a
+// fixed table of instruction forms with a fixed seed, so every byte decodes and runs are comparable
+// between releases and machines. Smaller corpora are prefixes of the largest one, cut at a function
+// boundary. Results are printed and written to `output` as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "oph/decoder.hpp"
+#include "oph/sigexpr.hpp"
+
+using namespace oph;
+
+constexpr uint64_t kSeed = 0x6F7068;
+constexpr double kMinSeconds = 0.25;
+// Only every this many RIP-relative and call instructions is kept as a CalcAbsAddr site.
+constexpr size_t kSiteSampling = 16;
+
+struct Function {
+  uint64_t offset;
+  uint64_t frame_size;
+  // Offset and instruction count of the corpus up to the end of this function.
+  uint64_t end;
+  uint64_t end_instructions;
+};
+
+struct Site {
+  uint32_t offset;
+  bool is_call;
+};
+
+struct Corpus {
+  std::vector<uint8_t> code;
+  std::vector<Function> functions;
+  std::vector<Site> sites;
+};
+
+// Random but valid instruction stream of at most `size` bytes. std::mt19937_64 output is fixed by
+// the standard, unlike the distributions, so only raw draws are used.
+Corpus Generate(size_t size) {
+  static constexpr uint8_t kRegs[] = {0, 1, 2, 3, 6, 7};  // rax, rcx, rdx, rbx, rsi, rdi
+  static constexpr size_t kMaxFunctionSize = 4096;
+
+  std::mt19937_64 rng(kSeed);
+  Corpus corpus;
+  auto& code = corpus.code;
+  code.reserve(size);
+  uint64_t num_instructions = 0;
+  size_t num_sites = 0;
+
+  auto op = [&](std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+    num_instructions++;
+  };
+  auto imm8 = [&](uint8_t value) { code.push_back(value); };
+  auto imm32 = [&](uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      code.push_back((uint8_t)(value >> (i * 8)));
+    }
+  };
+  auto site = [&](bool is_call) {
+    if (num_sites++ % kSiteSampling == 0) {
+      corpus.sites.push_back({(uint32_t)code.size(), is_call});
+    }
+  };
+
+  while (code.size() + kMaxFunctionSize <= size) {
+    Function function{code.size(), 0, 0, 0};
+
+    // push rbp; push rbx; sub rsp, imm
+    op({0x55});
+    op({0x53});
+    uint32_t frame = (uint32_t)(rng() % 64 + 1) * 8;
+    if (frame < 0x80) {
+      op({0x48, 0x83, 0xEC});
+      imm8((uint8_t)frame);
+    } else {
+      op({0x48, 0x81, 0xEC});
+      imm32(frame);
+    }
+    function.frame_size = 16 + frame;
+
+    size_t body_size = rng() % 240 + 16;
+    for (size_t i = 0; i < body_size; i++) {
+      uint8_t reg = kRegs[rng() % std::size(kRegs)];
+      uint8_t other = kRegs[rng() % std::size(kRegs)];
+      switch (rng() % 14) {
+        case 0:  // mov r64, r64
+          op({0x48, 0x89, (uint8_t)(0xC0 | other << 3 | reg)});
+          break;
+        case 1:  // mov r64, [rsp + disp8]
+          op({0x48, 0x8B, (uint8_t)(0x44 | reg << 3), 0x24});
+          imm8((uint8_t)(rng() % 16 * 8));
+          break;
+        case 2:  // mov [rsp + disp8], r64
+          op({0x48, 0x89, (uint8_t)(0x44 | reg << 3), 0x24});
+          imm8((uint8_t)(rng() % 16 * 8));
+          break;
+        case 3:  // lea r64, [rip + disp32]
+          site(false);
+          op({0x48, 0x8D, (uint8_t)(0x05 | reg << 3)});
+          imm32((uint32_t)rng());
+          break;
+        case 4:  // mov r32, imm32
+          op({(uint8_t)(0xB8 | reg)});
+          imm32((uint32_t)rng());
+          break;
+        case 5:  // call rel32
+          site(true);
+          op({0xE8});
+          imm32((uint32_t)rng());
+          break;
+        case 6:  // jcc rel8
+          op({(uint8_t)(0x70 | rng() % 16)});
+          imm8((uint8_t)rng());
+          break;
+        case 7:  // jcc rel32
+          op({0x0F, (uint8_t)(0x80 | rng() % 16)});
+          imm32((uint32_t)rng());
+          break;
+        case 8:  // cmp r32, imm8
+          op({0x83, (uint8_t)(0xF8 | reg)});
+          imm8((uint8_t)rng());
+          break;
+        case 9:  // test r32, r32
+          op({0x85, (uint8_t)(0xC0 | other << 3 | reg)});
+          break;
+        case 10:  // xor r32, r32
+          op({0x31, (uint8_t)(0xC0 | other << 3 | reg)});
+          break;
+        case 11:  // movzx r32, byte ptr [rcx + disp8]
+          op({0x0F, 0xB6, (uint8_t)(0x41 | reg << 3)});
+          imm8((uint8_t)rng());
+          break;
+        case 12:  // add r64, imm32
+          op({0x48, 0x81, (uint8_t)(0xC0 | reg)});
+          imm32((uint32_t)rng() & 0xFFFF);
+          break;
+        default:  // nop dword ptr [rax + rax + 0]
+          op({0x0F, 0x1F, 0x44, 0x00, 0x00});
+          break;
+      }
+    }
+
+    // add rsp, imm; pop rbx; pop rbp; ret; int3 up to a 16-byte boundary
+    if (frame < 0x80) {
+      op({0x48, 0x83, 0xC4});
+      imm8((uint8_t)frame);
+    } else {
+      op({0x48, 0x81, 0xC4});
+      imm32(frame);
+    }
+    op({0x5B});
+    op({0x5D});
+    op({0xC3});
+    while (code.size() % 16 != 0) {
+      op({0xCC});
+    }
+
+    function.end = code.size();
+    function.end_instructions = num_instructions;
+    corpus.functions.push_back(function);
+  }
+  return corpus;
+}
+
+// Seconds per call of `func`, repeated until kMinSeconds have passed.
+template <typename Func>
+double Measure(Func&& func) {
+  size_t iterations = 0;
+  double elapsed;
+  auto begin = std::chrono::steady_clock::now();
+  do {
+    func();
+    iterations++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  } while (elapsed < kMinSeconds);
+  return elapsed / iterations;
+}
+
+struct Result {
+  std::string benchmark;
+  std::vector<std::pair<std::string, std::string>> params;
+  uint64_t corpus_size;
+  double seconds;
+  // Bytes and instructions covered per call; either can be 0 when it does not apply.
+  uint64_t bytes;
+  uint64_t instructions;
+};
+
+std::vector<Result> results;
+bool failed = false;
+
+void Report(Result&& result) {
+  std::string params;
+  for (const auto& [key, value] : result.params) {
+    params += fmt::format("{}{}={}", params.empty() ? "" : " ", key, value);
+  }
+  std::string gbps = result.bytes != 0 ? fmt::format("{:.2f}", result.bytes / result.seconds / 1e9) : "-";
+  std::string mips = result.instructions != 0 ? fmt::format("{:.1f}", result.instructions / result.seconds / 1e6) : "-";
+  std::cout << fmt::format("{:<24} {:>6} {:<40} {:>10.3f} {:>8} {:>10}\n", result.benchmark, (result.corpus_size + (1 << 19)) >> 20, params, result.seconds * 1e3, gbps, mips);
+  results.push_back(std::move(result));
+}
+
+void Check(bool ok, std::string_view what) {
+  if (!ok) {
+    std::cerr << fmt::format("mismatch: {}\n", what);
+    failed = true;
+  }
+}
+
+// `length` bytes of `code` from `offset` in SigExpr syntax. About `density` of them are wildcards; an
+// anchor at "mid" also wildcards the first half so the first fixed byte sits in the middle.
+std::string MakePattern(std::span<const uint8_t> code, size_t offset, size_t length, int density, bool mid_anchor) {
+  std::mt19937_64 rng(kSeed ^ (length << 8 | density));
+  size_t anchor = mid_anchor ? length / 2 : 0;
+  std::string expr;
+  for (size_t i = 0; i < length; i++) {
+    bool wildcard = i < anchor || (i != anchor && i != length - 1 && (int)(rng() % 100) < density);
+    expr += fmt::format("{}{}", i == 0 ? "" : " ", wildcard ? "?" : fmt::format("{:02X}", code[offset + i]));
+  }
+  return expr;
+}
+
+void BenchSigExpr(std::span<const uint8_t> code, const Function& target, uint64_t num_instructions, std::span<const Function> functions, bool with_match) {
+  for (size_t length : {8, 16, 32, 64}) {
+    for (int density : {0, 25, 50}) {
+      for (bool mid_anchor : {false, true}) {
+        SigExpr sig(MakePattern(code, target.offset, length, density, mid_anchor));
+        std::vector<std::pair<std::string, std::string>> params = {
+            {"length", std::to_string(length)},
+            {"wildcards", fmt::format("{:.2f}", density / 100.0)},
+            {"anchor", mid_anchor ? "\"mid\"" : "\"lead\""},
+        };
+
+        std::vector<uint64_t> matches;
+        double seconds = Measure([&]() { matches = sig.Search(code); });
+        Check(std::ranges::binary_search(matches, target.offset), "SigExpr::Search missed the planted site");
+        Report({"SigExpr::Search", params, code.size(), seconds, code.size(), num_instructions});
+
+        if (with_match) {
+          // Verifies the signature at every function start, as after a cheap prefilter.
+          size_t num_matches = 0;
+          seconds = Measure([&]() {
+            num_matches = 0;
+            for (const auto& function : functions) {
+              num_matches += sig.Match(code.subspan(function.offset));
+            }
+          });
+          Check(num_matches >= 1, "SigExpr::Match missed the planted site");
+          Report({"SigExpr::Match", params, code.size(), seconds, functions.size() * length, 0});
+        }
+      }
+    }
+  }
+}
+
+void BenchDecoder(Decoder& decoder, std::span<const uint8_t> code, uint64_t num_instructions, std::span<const Function> functions, std::span<const Site> sites) {
+  // The predicates never hold, so each call decodes the whole corpus.
+  std::optional<uint64_t> found;
+  double seconds = Measure([&]() { found = decoder.FindIf(code, 0, [](const ZydisDecodedInstruction&) { return false; }); });
+  Check(!found.has_value(), "Decoder::FindIf stopped early");
+  Report({"Decoder::FindIf", {{"decode", "\"instruction\""}}, code.size(), seconds, code.size(), num_instructions});
+
+  seconds = Measure([&]() {
+    found = decoder.FindIf(code, 0, [](const ZydisDecodedInstruction&, const ZydisDecodedOperand[ZYDIS_MAX_OPERAND_COUNT]) { return false; });
+  });
+  Check(!found.has_value(), "Decoder::FindIf stopped early");
+  Report({"Decoder::FindIf", {{"decode", "\"full\""}}, code.size(), seconds, code.size(), num_instructions});
+
+  size_t num_resolved = 0;
+  seconds = Measure([&]() {
+    num_resolved = 0;
+    for (const auto& site : sites) {
+      auto to = site.is_call ? decoder.CalcAbsAddr(code, site.offset, ZYDIS_MNEMONIC_CALL, 0)
+                             : decoder.CalcAbsAddr(code, site.offset, ZYDIS_MNEMONIC_LEA, 1);
+      num_resolved += to.has_value();
+    }
+  });
+  Check(num_resolved == sites.size(), "Decoder::CalcAbsAddr failed on a planted site");
+  Report({"Decoder::CalcAbsAddr", {{"sites", std::to_string(sites.size())}}, code.size(), seconds, 0, sites.size()});
+
+  // Each prologue is push, push, sub.
+  size_t num_correct = 0;
+  seconds = Measure([&]() {
+    num_correct = 0;
+    for (const auto& function : functions) {
+      num_correct += decoder.CalcStackFrame(code.subspan(function.offset)) == function.frame_size;
+    }
+  });
+  Check(num_correct == functions.size(), "Decoder::CalcStackFrame returned a wrong frame size");
+  Report({"Decoder::CalcStackFrame", {{"functions", std::to_string(functions.size())}}, code.size(), seconds, 0, functions.size() * 3});
+}
+
+void WriteJson(const std::string& path) {
+  std::ofstream file(path);
+  file << fmt::format("{{\"seed\":{},\"results\":[", kSeed);
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    std::string params;
+    for (const auto& [key, value] : result.params) {
+      params += fmt::format("{}\"{}\":{}", params.empty() ? "" : ",", key, value);
+    }
+    file << fmt::format("{}\n{{\"benchmark\":\"{}\",\"corpus_bytes\":{},\"params\":{{{}}},\"seconds\":{:.9f},\"gb_per_s\":{:.4f},\"instructions_per_s\":{:.0f}}}",
+                        i == 0 ? "" : ",", result.benchmark, result.corpus_size, params, result.seconds,
+                        result.bytes / result.seconds / 1e9, result.instructions / result.seconds);
+  }
+  file << "\n]}\n";
+}
+
+int main(int argc, char** argv) {
+  static constexpr size_t kCorpusSizes[] = {1ull << 20, 4ull << 20, 16ull << 20, 64ull << 20, 256ull << 20, 1ull << 30};
+
+  size_t max_size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024) << 20;
+  std::string output = argc > 2 ? argv[2] : "scan.json";
+
+  auto begin = std::chrono::steady_clock::now();
+  Corpus corpus = Generate(max_size);
+  double generate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  std::cout << fmt::format("corpus: {} bytes, {} functions, {:.1f} s to generate\n\n", corpus.code.size(), corpus.functions.size(), generate_seconds);
+  std::cout << fmt::format("{:<24} {:>6} {:<40} {:>10} {:>8} {:>10}\n", "benchmark", "MB", "params", "time(ms)", "GB/s", "Minstr/s");
+
+  Decoder decoder(ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+  bool first = true;
+  for (size_t size : kCorpusSizes) {
+    if (size > max_size) {
+      break;
+    }
+
+    // Largest prefix of whole functions that fits.
+    auto last = std::ranges::upper_bound(corpus.functions, size, {}, &Function::end);
+    if (last == corpus.functions.begin()) {
+      continue;
+    }
+    std::span<const Function> functions(corpus.functions.begin(), last);
+    std::span<const uint8_t> code(corpus.code.data(), functions.back().end);
+    uint64_t num_instructions = functions.back().end_instructions;
+    auto sites_end = std::ranges::lower_bound(corpus.sites, code.size(), {}, &Site::offset);
+    std::span<const Site> sites(corpus.sites.begin(), sites_end);
+
+    // The signatures are taken from the function in the middle, so they match at least once.
+    BenchSigExpr(code, functions[functions.size() / 2], num_instructions, functions, first);
+    BenchDecoder(decoder, code, num_instructions, functions, sites);
+    first = false;
+  }
+
+  WriteJson(output);
+  std::cout << fmt::format("\nwritten to {}\n", output);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <latch>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "oph/thread-pool.hpp"
+
+using namespace oph;
+
+volatile uint64_t sink;
+
+void Spin(size_t iterations) {
+  uint64_t value = iterations;
+  for (size_t i = 0; i < iterations; i++) {
+    value = value * 6364136223846793005ull + 1442695040888963407ull;
+  }
+  sink = value;
+}
+
+template <typename Func>
+double Measure(Func&& func) {
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// Submits `num_tasks` independent tasks from the calling thread.
+double RunFlat(ThreadPool::ScheduleType schedule_type, size_t num_tasks, size_t task_work) {
+  ThreadPool pool(std::thread::hardware_concurrency(), schedule_type);
+  return Measure([&]() {
+    std::latch done(num_tasks);
+    for (size_t i = 0; i < num_tasks; i++) {
+      pool.EnqueueDetach([&done, task_work]() {
+        Spin(task_work);
+        done.count_down();
+      });
+    }
+    done.wait();
+  });
+}
+
+// Every task below `depth` submits two more from inside the pool, like recursive section splits.
+double RunNested(ThreadPool::ScheduleType schedule_type, size_t depth, size_t task_work) {
+  ThreadPool pool(std::thread::hardware_concurrency(), schedule_type);
+  return Measure([&]() {
+    std::latch done((size_t(1) << (depth + 1)) - 1);
+    std::function<void(size_t)> split = [&](size_t level) {
+      if (level < depth) {
+        pool.EnqueueDetach(split, level + 1);
+        pool.EnqueueDetach(split, level + 1);
+      }
+      Spin(task_work);
+      done.count_down();
+    };
+    pool.EnqueueDetach(split, 0);
+    done.wait();
+  });
+}
+
+int main() {
+  static constexpr size_t kTaskCounts[] = {1'000, 10'000, 100'000, 1'000'000};
+  static constexpr size_t kTaskWorks[] = {0, 64, 1'024, 16'384};
+  static constexpr size_t kMaxTotalWork = 1ull << 30;
+
+  std::cout << fmt::format("threads: {}\n\n", std::thread::hardware_concurrency());
+  std::cout << fmt::format("{:<8} {:>10} {:>8} {:>14} {:>14} {:>8}\n", "shape", "tasks", "work", "shared(ms)", "stealing(ms)", "speedup");
+
+  for (size_t task_work : kTaskWorks) {
+    for (size_t num_tasks : kTaskCounts) {
+      if (num_tasks * task_work > kMaxTotalWork) {
+        continue;
+      }
+
+      double shared = RunFlat(ThreadPool::kSharedQueue, num_tasks, task_work);
+      double stealing = RunFlat(ThreadPool::kWorkStealing, num_tasks, task_work);
+      std::cout << fmt::format("{:<8} {:>10} {:>8} {:>14.3f} {:>14.3f} {:>7.2f}x\n", "flat", num_tasks, task_work, shared, stealing, shared / stealing);
+    }
+  }
+
+  for (size_t task_work : kTaskWorks) {
+    for (size_t depth : {10, 14, 17}) {
+      size_t num_tasks = (size_t(1) << (depth + 1)) - 1;
+      if (num_tasks * task_work > kMaxTotalWork) {
+        continue;
+      }
+
+      double shared = RunNested(ThreadPool::kSharedQueue, depth, task_work);
+      double stealing = RunNested(ThreadPool::kWorkStealing, depth, task_work);
+      std::cout << fmt::format("{:<8} {:>10} {:>8} {:>14.3f} {:>14.3f} {:>7.2f}x\n", "nested", num_tasks, task_work, shared, stealing, shared / stealing);
+    }
+  }
+
+  return 0;
+}
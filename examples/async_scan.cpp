@@ -0,0 +1,43 @@
+#include <iostream>
+
+#include "oph/sigexpr.hpp"
+#include "oph/thread-pool.hpp"
+
+using namespace oph;
+
+uint8_t data[] =
+{
+  0x48, 0x8D, 0x0D, 0x10, 0x00, 0x00, 0x00,  // lea rcx,[rip+10]
+  0xE8, 0x20, 0x00, 0x00, 0x00,              // call +20
+  0x48, 0x8D, 0x0D, 0x30, 0x00, 0x00, 0x00,  // lea rcx,[rip+30]
+  0xE8, 0x40, 0x00, 0x00, 0x00,              // call +40
+};
+
+SigExpr sig_lea = "48 8D 0D ? ? ? ?";
+SigExpr sig_call = "E8 ? ? ? ?";
+
+// Runs on a pool worker; the caller only waits for it through `co_await`
+Async<size_t> CountMatches(ThreadPool& pool, const SigExpr& sig) {
+  co_await pool.Schedule();
+  co_return sig.Search(data).size();
+}
+
+Async<size_t> CountAll(ThreadPool& pool) {
+  std::vector<Async<size_t>> counts;
+  counts.push_back(CountMatches(pool, sig_lea));
+  counts.push_back(CountMatches(pool, sig_call));
+
+  size_t total = 0;
+  for (size_t count : co_await pool.WhenAll(std::move(counts))) {
+    total += count;
+  }
+  co_return total;
+}
+
+int main() {
+  // A single worker is enough: waiting coroutines do not hold it
+  ThreadPool pool(1);
+  std::cout << "Matches: " << pool.Spawn(CountAll(pool)).Get() << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,29 @@
+// Scans every archived build of Easy_CrackMe.exe in builds/ and records the results in
+// offsets.csv. Builds already in offsets.csv from an earlier run are not loaded again.
+
+#include <filesystem>
+#include <iostream>
+
+#include "oph/batch.hpp"
+#include "oph/sig-scan.hpp"
+
+int main() {
+  oph::BatchRunner runner;
+  runner.WriteOffset("OFFSET_SIG_HIT", oph::SigScan("Easy_CrackMe.exe", ".text", "68 E8 03 00 00 ? FF ? ? ? ? ? 80 ? ? ? 61 75 ? 6A 02").ToVA());
+  runner.WriteOffset("OFFSET_IMAGE_BASE", [](const oph::DumpStore& store) { return store.GetModule("Easy_CrackMe.exe").GetBaseAddr(); });
+
+  for (const auto& entry : std::filesystem::directory_iterator("builds")) {
+    auto build_name = entry.path().stem().string();
+    auto file_path = entry.path().string();
+    runner.AddBuild(build_name, [=](oph::DumpStore& store) { store.LoadModule("Easy_CrackMe.exe", file_path, build_name); });
+  }
+
+  if (std::filesystem::exists("offsets.csv")) {
+    runner.ImportMatrix(std::string("offsets.csv"));
+  }
+  runner.Run();
+  runner.ExportMatrix(std::string("offsets.csv"));
+  runner.ExportMatrix(std::cout);
+
+  return 0;
+}
@@ -11,24 +11,33 @@
 oph::Decoder decoder = oph::Decoder(ZYDIS_MACHINE_MODE_LEGACY_32, ZYDIS_STACK_WIDTH_32);
 oph::SigExpr sig = "68 E8 03 00 00 ? FF ? ? ? ? ? 80 ? ? ? 61 75 ? 6A 02";
 
-uint64_t ScanHookPoint(const oph::DumpStore& store) {
+// Searched once and shared by both offsets below
+uint64_t ScanSigHit(const oph::DumpStore& store) {
   const auto& sec = store.GetSection("Easy_CrackMe.exe", ".text");
-  auto offset = sig.Search(sec.GetDump(), 1, 0);
-  return offset + sec.GetVA() + 0x11;
+  return sig.Search(sec.GetDump(), 1, 0);
 }
 
-uint64_t ScanJumpTo(const oph::DumpStore& store) {
+uint64_t ScanHookPoint(const oph::DumpStore& store, std::span<const uint64_t> deps) {
   const auto& sec = store.GetSection("Easy_CrackMe.exe", ".text");
-  auto offset = sig.Search(sec.GetDump(), 1, 0);
-  offset = decoder.CalcAbsAddr(sec.GetDump(), offset + 0x11, ZYDIS_MNEMONIC_JNZ, 0).value();
+  return deps[0] + sec.GetVA() + 0x11;
+}
+
+uint64_t ScanJumpTo(const oph::DumpStore& store, std::span<const uint64_t> deps) {
+  const auto& sec = store.GetSection("Easy_CrackMe.exe", ".text");
+  auto offset = decoder.CalcAbsAddr(sec.GetDump(), deps[0] + 0x11, ZYDIS_MNEMONIC_JNZ, 0).value();
   return offset + sec.GetVA();
 }
 
 int main() {
   oph::Patcher patcher(oph::Patcher::kCpp);
   patcher.AddModule("Easy_CrackMe.exe");
-  patcher.WriteOffset("OFFSET_HOOK_POINT", ScanHookPoint);
-  patcher.WriteOffset("OFFSET_JUMP_TO", ScanJumpTo);
+  patcher.DefineScan("SIG_HIT", ScanSigHit);
+  patcher.WriteOffset("OFFSET_HOOK_POINT", {"SIG_HIT"}, ScanHookPoint);
+  patcher.WriteOffset("OFFSET_JUMP_TO", {"SIG_HIT"}, ScanJumpTo);
+
+  // Named lambdas are copied into the scan, so one can be kept and passed again.
+  auto scan_image_base = [](const oph::DumpStore& store) { return store.GetModule("Easy_CrackMe.exe").GetBaseAddr(); };
+  patcher.WriteOffset("OFFSET_IMAGE_BASE", scan_image_base);
   patcher.Export(std::cout);
 
   return 0;
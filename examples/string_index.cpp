@@ -0,0 +1,102 @@
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "oph/memory.hpp"
+#include "oph/string-index.hpp"
+
+using namespace oph;
+
+// Loaded at 0x400000 with file offsets equal to RVAs.
+constexpr uint64_t kImageBase = 0x400000;
+constexpr uint64_t kTextRVA = 0x100;
+constexpr uint64_t kDataRVA = 0x140;
+constexpr uint64_t kNamesRVA = 0x160;
+constexpr uint64_t kSectionHeadersRVA = 0x180;
+
+// Bytes before each load look like prefixes: the 48 ending `sub rsp,48` would be a second REX, and
+// the 66 ending `mov ax,6634` an operand size override under REX.W. Neither must move the reference.
+uint8_t text[] =
+{
+  0x48, 0x83, 0xEC, 0x48,                    // sub rsp,48
+  0x48, 0x8D, 0x0D, 0x35, 0x00, 0x00, 0x00,  // lea rcx,[400140]
+  0x66, 0xB8, 0x34, 0x66,                    // mov ax,6634
+  0x48, 0x8B, 0x05, 0x2A, 0x00, 0x00, 0x00,  // mov rax,[400140]
+  0x48, 0x83, 0xC4, 0x48,                    // add rsp,48
+  0xC3,                                      // ret
+};
+
+const char data[] = "Hello, world!";
+const char names[] = "\0.text\0.rodata\0.shstrtab";
+
+template <typename T>
+void Put(std::vector<uint8_t>& file, uint64_t offset, T value) {
+  std::memcpy(file.data() + offset, &value, sizeof(T));
+}
+
+// ELF64 executable with one loadable segment covering the whole file.
+std::vector<uint8_t> BuildELF() {
+  std::vector<uint8_t> file(kSectionHeadersRVA + 4 * 0x40);
+  const uint8_t ident[] = {0x7F, 'E', 'L', 'F', 2, 1, 1};
+  std::memcpy(file.data(), ident, sizeof(ident));
+  Put<uint16_t>(file, 0x10, 2);     // ET_EXEC
+  Put<uint16_t>(file, 0x12, 0x3E);  // EM_X86_64
+  Put<uint32_t>(file, 0x14, 1);
+  Put<uint64_t>(file, 0x20, 0x40);
+  Put<uint64_t>(file, 0x28, kSectionHeadersRVA);
+  Put<uint16_t>(file, 0x36, 0x38);
+  Put<uint16_t>(file, 0x38, 1);
+  Put<uint16_t>(file, 0x3A, 0x40);
+  Put<uint16_t>(file, 0x3C, 4);
+  Put<uint16_t>(file, 0x3E, 3);
+
+  Put<uint32_t>(file, 0x40, 1);  // PT_LOAD
+  Put<uint64_t>(file, 0x50, kImageBase);
+  Put<uint64_t>(file, 0x60, file.size());
+  Put<uint64_t>(file, 0x68, file.size());
+  Put<uint64_t>(file, 0x70, 0x1000);
+
+  auto section = [&](uint16_t index, uint32_t name, uint32_t type, uint64_t flags, uint64_t rva, uint64_t size) {
+    uint64_t header = kSectionHeadersRVA + index * 0x40;
+    Put<uint32_t>(file, header, name);
+    Put<uint32_t>(file, header + 0x04, type);
+    Put<uint64_t>(file, header + 0x08, flags);
+    Put<uint64_t>(file, header + 0x10, flags != 0 ? kImageBase + rva : 0);
+    Put<uint64_t>(file, header + 0x18, rva);
+    Put<uint64_t>(file, header + 0x20, size);
+  };
+  section(1, 1, 1, 0x6, kTextRVA, sizeof(text));   // PROGBITS, ALLOC+EXEC
+  section(2, 7, 1, 0x2, kDataRVA, sizeof(data));   // PROGBITS, ALLOC
+  section(3, 15, 3, 0, kNamesRVA, sizeof(names));  // STRTAB
+
+  std::memcpy(file.data() + kTextRVA, text, sizeof(text));
+  std::memcpy(file.data() + kDataRVA, data, sizeof(data));
+  std::memcpy(file.data() + kNamesRVA, names, sizeof(names));
+  return file;
+}
+
+int main() {
+  auto path = std::filesystem::temp_directory_path() / "oph_string_index.elf";
+  auto file = BuildELF();
+  std::ofstream(path, std::ios::binary).write((const char*)file.data(), file.size());
+
+  DumpStore store;
+  store.LoadModule("hello", path.string(), "1.0");
+  std::filesystem::remove(path);
+
+  Decoder decoder(ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+  StringIndex index(decoder, store.GetSection("hello", ".text"), store.GetSection("hello", ".rodata"));
+
+  // Expected 400104 (lea) and 40010F (mov)
+  auto refs = index.FindRefs("Hello, world!");
+  std::cout << "FindRefs: " << std::hex;
+  for (uint64_t ref : refs) {
+    std::cout << ref << " ";
+  }
+  std::cout << std::endl;
+
+  return refs == std::vector<uint64_t>{kImageBase + kTextRVA + 4, kImageBase + kTextRVA + 15} ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+// C++ standard
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace oph {
+template <typename T>
+class Async;
+
+class AsyncPromiseBase {
+ public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  auto final_suspend() noexcept {
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept {
+        return continuation ? continuation : std::noop_coroutine();
+      }
+
+      void await_resume() noexcept {}
+
+      std::coroutine_handle<> continuation;
+    };
+    return FinalAwaiter{continuation_};
+  }
+
+  void unhandled_exception() {
+    exception_ = std::current_exception();
+  }
+
+ protected:
+  template <typename T>
+  friend class Async;
+
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+};
+
+template <typename T>
+class AsyncPromise : public AsyncPromiseBase {
+ public:
+  Async<T> get_return_object();
+
+  template <typename Value>
+    requires std::is_convertible_v<Value&&, T>
+  void return_value(Value&& value) {
+    value_.template emplace<1>(std::forward<Value>(value));
+  }
+
+  T TakeValue() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+    return std::move(std::get<1>(value_));
+  }
+
+ private:
+  std::variant<std::monostate, T> value_;
+};
+
+template <>
+class AsyncPromise<void> : public AsyncPromiseBase {
+ public:
+  Async<void> get_return_object();
+
+  void return_void() {}
+
+  void TakeValue() {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+};
+
+// Lazily started coroutine. Nothing runs until it is awaited (or handed to ThreadPool::Spawn), and
+// awaiting it runs it on the awaiting thread until it suspends itself, e.g. on `pool.Schedule()` or
+// on a Future, neither of which holds a thread while waiting.
+template <typename T>
+class Async {
+ public:
+  using promise_type = AsyncPromise<T>;
+
+  Async() : handle_(nullptr) {}
+
+  explicit Async(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  Async(Async&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  Async& operator=(Async&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Async() {
+    Reset();
+  }
+
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return handle.done(); }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation_ = awaiting;
+        return handle;
+      }
+
+      T await_resume() { return handle.promise().TakeValue(); }
+
+      std::coroutine_handle<promise_type> handle;
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  Async(const Async&) = delete;
+  Async& operator=(const Async&) = delete;
+
+  void Reset() {
+    if (handle_) {
+      std::exchange(handle_, nullptr).destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Async<T> AsyncPromise<T>::get_return_object() {
+  return Async<T>(std::coroutine_handle<AsyncPromise<T>>::from_promise(*this));
+}
+
+inline Async<void> AsyncPromise<void>::get_return_object() {
+  return Async<void>(std::coroutine_handle<AsyncPromise<void>>::from_promise(*this));
+}
+
+// Eagerly started, self-destroying coroutine used to drive an Async to completion from plain code.
+struct DetachedAsync {
+  struct promise_type {
+    DetachedAsync get_return_object() noexcept { return {}; }
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    std::suspend_never final_suspend() noexcept { return {}; }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+}  // namespace oph
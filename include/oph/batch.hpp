@@ -0,0 +1,433 @@
+#pragma once
+
+// C++ standard
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Other library
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fmt/ranges.h>
+
+// This project
+#include "formatter.hpp"
+#include "memory.hpp"
+#include "patcher.hpp"
+#include "sig-scan.hpp"
+#include "sigexpr.hpp"
+#include "thread-pool.hpp"
+
+namespace oph {
+// Runs one script of scans against a corpus of builds, e.g. archived versions of a target, to see
+// in which build an offset breaks. Every build gets a DumpStore of its own, but all of them share
+// one pool, and the signatures of the SigScans are indexed once for the whole corpus.
+//
+// Builds are loaded only when they are scanned and released right after, so at most about as many
+// as the pool has threads are held in memory at once. Builds are scanned concurrently, so a scan
+// function must be safe to call for several stores at the same time.
+class BatchRunner {
+ public:
+  // Fills the store of one build, e.g. with DumpStore::LoadModule.
+  using LoadFunc = std::function<void(DumpStore&)>;
+
+  // One cell of the result matrix.
+  struct Result {
+    SlotValue::Status status = SlotValue::kError;
+    uint64_t offset = 0;
+    std::vector<uint8_t> bytes;
+  };
+
+  BatchRunner(size_t num_threads = std::thread::hardware_concurrency(), ThreadPool::ScheduleType schedule_type = ThreadPool::kSharedQueue)
+      : pool_(num_threads, schedule_type) {}
+
+  BatchRunner& AddBuild(std::string_view build_name, LoadFunc load) {
+    CheckName(build_name);
+    if (build_indices_.contains(std::string(build_name))) {
+      throw std::runtime_error(std::format("oph/batch: build that already exists: {}", build_name));
+    }
+
+    build_indices_.emplace(build_name, builds_.size());
+    builds_.push_back({std::string(build_name), std::move(load), false, {}, {}});
+    return *this;
+  }
+
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, uint64_t> && (!std::is_same_v<std::decay_t<ScanFunc>, SigScan>)
+  BatchRunner& WriteOffset(std::string_view name, ScanFunc&& scan_func) {
+    func_scans_.emplace_back(AddColumn(name, false), [_scan_func = std::forward<ScanFunc>(scan_func)](const DumpStore& store) mutable {
+      return Result{SlotValue::kOk, InvokeScan(_scan_func, std::stop_token(), store)};
+    });
+    return *this;
+  }
+
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, std::vector<uint8_t>>
+  BatchRunner& WriteBytes(std::string_view name, ScanFunc&& scan_func) {
+    func_scans_.emplace_back(AddColumn(name, true), [_scan_func = std::forward<ScanFunc>(scan_func)](const DumpStore& store) mutable {
+      return Result{SlotValue::kOk, 0, InvokeScan(_scan_func, std::stop_token(), store)};
+    });
+    return *this;
+  }
+
+  // Like in Patcher, the SigScans of one section are searched in one pass per build.
+  BatchRunner& WriteOffset(std::string_view name, const SigScan& scan) {
+    sig_scans_.emplace_back(AddColumn(name, false), scan);
+    return *this;
+  }
+
+  // Scans every build that has not been scanned yet, by an earlier call or according to an
+  // imported matrix, and keeps the results of the others. The script cannot change afterwards.
+  void Run() {
+    script_frozen_ = true;
+
+    std::vector<Build*> pending;
+    for (auto& build : builds_) {
+      if (!build.scanned) {
+        pending.push_back(&build);
+      }
+    }
+    if (pending.empty()) {
+      return;
+    }
+
+    auto sig_groups = PlanSigGroups();
+    pool_.ParallelFor(0, pending.size(), 1, [&](size_t i) { RunBuild(*pending[i], sig_groups); });
+  }
+
+  bool IsScanned(std::string_view build_name) const {
+    return GetBuild(build_name).scanned;
+  }
+
+  const Result& GetResult(std::string_view build_name, std::string_view scan_name) const {
+    const auto& build = GetBuild(build_name);
+    if (!build.scanned) {
+      throw std::runtime_error(std::format("oph/batch: build that has not been scanned: {}", build_name));
+    }
+
+    for (size_t i = 0; i < columns_.size(); i++) {
+      if (columns_[i].name == scan_name) {
+        return build.results[i];
+      }
+    }
+    throw std::runtime_error(std::format("oph/batch: scan that does not exist: {}", scan_name));
+  }
+
+  // Writes one CSV row per scanned build and one column per scan, in the order they were added.
+  // Offsets are written as hex numbers, bytes as hex pairs separated by spaces, and failed scans,
+  // including every scan of a build that could not be loaded, as ERROR.
+  void ExportMatrix(std::ostream& os) const {
+    fmt::print(os, "build");
+    for (const auto& column : columns_) {
+      fmt::print(os, ",{}", column.name);
+    }
+    fmt::print(os, "\n");
+
+    for (const auto& build : builds_) {
+      if (!build.scanned) {
+        continue;
+      }
+
+      fmt::print(os, "{}", build.name);
+      for (size_t i = 0; i < columns_.size(); i++) {
+        const auto& result = build.results[i];
+        if (result.status == SlotValue::kTimeout) {
+          fmt::print(os, ",TIMEOUT");
+        } else if (result.status != SlotValue::kOk) {
+          fmt::print(os, ",ERROR");
+        } else if (columns_[i].is_bytes) {
+          fmt::print(os, ",{:02X}", fmt::join(result.bytes, " "));
+        } else {
+          fmt::print(os, ",0x{:X}", result.offset);
+        }
+      }
+      fmt::print(os, "\n");
+    }
+  }
+
+  void ExportMatrix(const std::string& file_path) const {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+      ExportMatrix(file);
+    }
+  }
+
+  // Reads back a matrix written by ExportMatrix for the same script, so that Run skips the builds
+  // in it. Builds that have not been added are added without a loader, to keep them in the matrix.
+  void ImportMatrix(std::istream& is) {
+    script_frozen_ = true;
+
+    std::string line;
+    if (!std::getline(is, line) || SplitRow(line) != GetHeader()) {
+      throw std::runtime_error("oph/batch: matrix that does not match the scans");
+    }
+
+    while (std::getline(is, line)) {
+      if (line.empty()) {
+        continue;
+      }
+
+      auto cells = SplitRow(line);
+      if (cells.size() != columns_.size() + 1) {
+        throw std::runtime_error(std::format("oph/batch: matrix row of unexpected size: {}", cells[0]));
+      }
+
+      std::vector<Result> results(columns_.size());
+      for (size_t i = 0; i < columns_.size(); i++) {
+        results[i] = ParseCell(cells[i + 1], columns_[i].is_bytes);
+      }
+
+      auto iter = build_indices_.find(cells[0]);
+      if (iter == build_indices_.end()) {
+        AddBuild(cells[0], nullptr);
+        iter = build_indices_.find(cells[0]);
+      }
+      auto& build = builds_[iter->second];
+      build.results = std::move(results);
+      build.scanned = true;
+    }
+  }
+
+  void ImportMatrix(const std::string& file_path) {
+    std::ifstream file(file_path, std::ios::binary);
+    if (file.is_open()) {
+      ImportMatrix(file);
+    }
+  }
+
+  // Why a scanned build has whole groups of ERROR cells: its loader threw, or the pass over a section
+  // for its SigScans failed. Scans that fail on their own, e.g. a signature that is not found, only
+  // show up in their cell. Builds read back by ImportMatrix have none.
+  const std::vector<std::string>& GetErrors(std::string_view build_name) const {
+    return GetBuild(build_name).errors;
+  }
+
+  ThreadPool& GetPool() { return pool_; }
+
+ private:
+  struct Column {
+    std::string name;
+    bool is_bytes;
+  };
+
+  struct Build {
+    std::string name;
+    LoadFunc load;
+    bool scanned = false;
+    std::vector<Result> results;
+    std::vector<std::string> errors;
+  };
+
+  // The SigScans of one section with the index of their signatures, built once per Run.
+  struct SigGroup {
+    std::string module_name;
+    std::string section_name;
+    std::vector<const std::pair<size_t, SigScan>*> scans;
+    std::unique_ptr<SigSet> sig_set;
+  };
+
+  // Build and scan names end up in the matrix as they are, so they cannot contain its separators.
+  static void CheckName(std::string_view name) {
+    if (name.empty() || name.find_first_of(",\r\n") != std::string_view::npos) {
+      throw std::runtime_error(std::format("oph/batch: name that cannot be written to the matrix: {}", name));
+    }
+  }
+
+  size_t AddColumn(std::string_view name, bool is_bytes) {
+    if (script_frozen_) {
+      throw std::runtime_error("oph/batch: scans must be added before Run or ImportMatrix");
+    }
+    CheckName(name);
+    for (const auto& column : columns_) {
+      if (column.name == name) {
+        throw std::runtime_error(std::format("oph/batch: scan that already exists: {}", name));
+      }
+    }
+
+    columns_.push_back({std::string(name), is_bytes});
+    return columns_.size() - 1;
+  }
+
+  const Build& GetBuild(std::string_view build_name) const {
+    auto iter = build_indices_.find(std::string(build_name));
+    if (iter == build_indices_.end()) {
+      throw std::runtime_error(std::format("oph/batch: build that does not exist: {}", build_name));
+    }
+    return builds_[iter->second];
+  }
+
+  std::vector<SigGroup> PlanSigGroups() const {
+    std::map<std::pair<std::string, std::string>, std::vector<const std::pair<size_t, SigScan>*>> sections;
+    for (const auto& scan : sig_scans_) {
+      sections[{scan.second.GetModuleName(), scan.second.GetSectionName()}].push_back(&scan);
+    }
+
+    std::vector<SigGroup> sig_groups;
+    sig_groups.reserve(sections.size());
+    for (auto& [section_key, scans] : sections) {
+      std::vector<const SigExpr*> sigs;
+      sigs.reserve(scans.size());
+      for (auto scan : scans) {
+        sigs.push_back(&scan->second.GetSig());
+      }
+      sig_groups.push_back({section_key.first, section_key.second, std::move(scans), std::make_unique<SigSet>(std::move(sigs))});
+    }
+    return sig_groups;
+  }
+
+  // A build whose loader throws keeps every result at ERROR.
+  void RunBuild(Build& build, const std::vector<SigGroup>& sig_groups) {
+    build.results.assign(columns_.size(), Result());
+    build.errors.clear();
+
+    DumpStore store;
+    try {
+      if (build.load == nullptr) {
+        throw std::runtime_error("oph/batch: build without a loader");
+      }
+      build.load(store);
+    } catch (...) {
+      AddError(build, std::format("load: {}", DescribeException()));
+      build.scanned = true;
+      return;
+    }
+
+    pool_.ParallelFor(0, func_scans_.size() + sig_groups.size(), 1, [&](size_t i) {
+      if (i < func_scans_.size()) {
+        auto& [column, scan_func] = func_scans_[i];
+        try {
+          build.results[column] = scan_func(store);
+        } catch (...) {
+        }
+      } else {
+        RunSigGroup(build, store, sig_groups[i - func_scans_.size()]);
+      }
+    });
+    build.scanned = true;
+  }
+
+  void RunSigGroup(Build& build, const DumpStore& store, const SigGroup& sig_group) {
+    if (!store.Contains(sig_group.module_name, sig_group.section_name)) {
+      return;
+    }
+
+    const auto& section = store.GetSection(sig_group.module_name, sig_group.section_name);
+    std::vector<std::vector<uint64_t>> matches;
+    try {
+      matches = sig_group.sig_set->Search(pool_, section.GetDump());
+    } catch (...) {
+      AddError(build, std::format("SigScan pass over {} {}: {}", sig_group.module_name, sig_group.section_name, DescribeException()));
+      return;
+    }
+
+    for (size_t i = 0; i < sig_group.scans.size(); i++) {
+      const auto& [column, scan] = *sig_group.scans[i];
+      try {
+        build.results[column] = Result{SlotValue::kOk, scan.Resolve(section, matches[i]), {}};
+      } catch (...) {
+      }
+    }
+  }
+
+  // The sections of one build are scanned concurrently, so their errors are added under a lock.
+  void AddError(Build& build, std::string error) {
+    std::lock_guard<std::mutex> lock(errors_mutex_);
+    build.errors.push_back(std::move(error));
+  }
+
+  // Message of the exception being handled.
+  static std::string DescribeException() {
+    try {
+      throw;
+    } catch (const std::exception& e) {
+      return e.what();
+    } catch (...) {
+      return "unknown exception";
+    }
+  }
+
+  std::vector<std::string> GetHeader() const {
+    std::vector<std::string> header = {"build"};
+    for (const auto& column : columns_) {
+      header.push_back(column.name);
+    }
+    return header;
+  }
+
+  static std::vector<std::string> SplitRow(std::string_view line) {
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    std::vector<std::string> cells;
+    size_t begin = 0, end;
+    while ((end = line.find(',', begin)) != std::string_view::npos) {
+      cells.emplace_back(line.substr(begin, end - begin));
+      begin = end + 1;
+    }
+    cells.emplace_back(line.substr(begin));
+    return cells;
+  }
+
+  static Result ParseCell(std::string_view cell, bool is_bytes) {
+    if (cell == "ERROR") {
+      return Result{SlotValue::kError, 0, {}};
+    }
+    if (cell == "TIMEOUT") {
+      return Result{SlotValue::kTimeout, 0, {}};
+    }
+
+    auto parse_hex = [&](std::string_view str, auto& value) {
+      auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value, 16);
+      if (str.empty() || ec != std::errc() || ptr != str.data() + str.size()) {
+        throw std::runtime_error(std::format("oph/batch: invalid matrix cell: {}", cell));
+      }
+    };
+
+    Result result{SlotValue::kOk, 0, {}};
+    if (!is_bytes) {
+      if (!cell.starts_with("0x")) {
+        throw std::runtime_error(std::format("oph/batch: invalid matrix cell: {}", cell));
+      }
+      parse_hex(cell.substr(2), result.offset);
+      return result;
+    }
+
+    size_t begin = 0, end;
+    while ((begin = cell.find_first_not_of(' ', begin)) != std::string_view::npos) {
+      end = cell.find(' ', begin);
+      uint8_t byte;
+      parse_hex(cell.substr(begin, end - begin), byte);
+      result.bytes.push_back(byte);
+      begin = end;
+    }
+    return result;
+  }
+
+  std::vector<Column> columns_;
+  std::vector<std::pair<size_t, std::function<Result(const DumpStore&)>>> func_scans_;
+  std::vector<std::pair<size_t, SigScan>> sig_scans_;
+  std::vector<Build> builds_;
+  std::unordered_map<std::string, size_t> build_indices_;
+  bool script_frozen_ = false;
+  std::mutex errors_mutex_;
+  ThreadPool pool_;
+};
+}  // namespace oph
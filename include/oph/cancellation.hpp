@@ -0,0 +1,20 @@
+#pragma once
+
+// C++ standard
+#include <stdexcept>
+#include <stop_token>
+
+namespace oph {
+// Thrown out of a long search or decoder sweep once its stop token is triggered, so a scan function
+// that was given a token unwinds without having to check it itself.
+class Cancelled : public std::runtime_error {
+ public:
+  Cancelled() : std::runtime_error("oph: operation cancelled") {}
+};
+
+inline void ThrowIfStopRequested(const std::stop_token& stoken) {
+  if (stoken.stop_requested()) {
+    throw Cancelled();
+  }
+}
+}  // namespace oph
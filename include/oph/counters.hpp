@@ -0,0 +1,135 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Define as 1 to compile the counters in. Otherwise every Counters::Add is an empty inline function.
+#ifndef OPH_ENABLE_COUNTERS
+#define OPH_ENABLE_COUNTERS 0
+#endif
+
+namespace oph {
+// Process-wide event counters of the search and decode hot paths. Each thread counts into its own
+// block, so the hot paths never contend; Collect sums the blocks on request. When compiled in they
+// start enabled and can be switched off and on at runtime.
+class Counters {
+ public:
+  enum Id : size_t {
+    kSigBytesScanned,
+    kSigCandidates,
+    kSigVerifications,
+    kSigMatches,
+    kDecodedInstructions,
+    kFullDecodes,
+    kInstructionDecodes,
+    kDecodeFailures,
+    kNumCounters,
+  };
+
+  using Values = std::array<uint64_t, kNumCounters>;
+
+  static constexpr bool kCompiled = OPH_ENABLE_COUNTERS != 0;
+
+  static constexpr std::array<std::string_view, kNumCounters> kNames = {
+      "sig_bytes_scanned",
+      "sig_candidates",
+      "sig_verifications",
+      "sig_matches",
+      "decoded_instructions",
+      "full_decodes",
+      "instruction_decodes",
+      "decode_failures",
+  };
+
+  static void SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  static bool IsEnabled() {
+    return kCompiled && enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void Add(Id id, uint64_t value) {
+    if constexpr (kCompiled) {
+      if (enabled_.load(std::memory_order_relaxed)) {
+        // Only the owning thread writes, so a plain load and store is enough and avoids a locked add.
+        auto& counter = GetLocal().values[id];
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Totals since the last Reset over every thread, including the ones that have exited.
+  static Values Collect() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Values values = retired_;
+    for (auto local : locals_) {
+      for (size_t i = 0; i < kNumCounters; i++) {
+        values[i] += local->values[i].load(std::memory_order_relaxed);
+      }
+    }
+    for (size_t i = 0; i < kNumCounters; i++) {
+      values[i] -= baseline_[i];
+    }
+    return values;
+  }
+
+  // Other threads keep counting into their own blocks, so this only moves the baseline.
+  static void Reset() {
+    auto values = Collect();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < kNumCounters; i++) {
+      baseline_[i] += values[i];
+    }
+  }
+
+  // Writes the totals along with the ratios that tell how selective the signatures are and how much
+  // decoding is wasted.
+  static void Report(std::ostream& os, const Values& values) {
+    for (size_t i = 0; i < kNumCounters; i++) {
+      os << kNames[i] << ": " << values[i] << '\n';
+    }
+
+    auto ratio = [](uint64_t num, uint64_t den) { return den == 0 ? 0.0 : (double)num / den; };
+    os << "sig_candidates_per_kb: " << ratio(values[kSigCandidates] * 1024, values[kSigBytesScanned]) << '\n';
+    os << "sig_match_rate: " << ratio(values[kSigMatches], values[kSigVerifications]) << '\n';
+    os << "decode_failure_rate: " << ratio(values[kDecodeFailures], values[kFullDecodes] + values[kInstructionDecodes]) << '\n';
+  }
+
+ private:
+  struct Local {
+    Local() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      locals_.push_back(this);
+    }
+
+    ~Local() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < kNumCounters; i++) {
+        retired_[i] += values[i].load(std::memory_order_relaxed);
+      }
+      locals_.erase(std::ranges::find(locals_, this));
+    }
+
+    std::array<std::atomic_uint64_t, kNumCounters> values = {};
+  };
+
+  static Local& GetLocal() {
+    static thread_local Local local;
+    return local;
+  }
+
+  static inline std::atomic_bool enabled_ = true;
+  static inline std::mutex mutex_;
+  static inline std::vector<Local*> locals_;
+  static inline Values retired_ = {};
+  static inline Values baseline_ = {};
+};
+}  // namespace oph
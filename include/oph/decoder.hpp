@@ -3,12 +3,19 @@
 // C++ standard
 #include <concepts>
 #include <cstdint>
+#include <functional>
 #include <optional>
 #include <span>
+#include <stop_token>
 
 // Other library
 #include <Zydis/Zydis.h>
 
+// This project
+#include "cancellation.hpp"
+#include "counters.hpp"
+#include "scan-stats.hpp"
+
 namespace oph {
 class Decoder {
  public:
@@ -17,7 +24,9 @@ class Decoder {
   }
 
   ZyanStatus DecodeInstruction(const void* buffer, ZyanISize buffer_size, ZydisDecodedInstruction* instruction) {
-    return ZydisDecoderDecodeInstruction(&decoder_, nullptr, buffer, buffer_size, instruction);
+    ZyanStatus status = ZydisDecoderDecodeInstruction(&decoder_, nullptr, buffer, buffer_size, instruction);
+    CountDecode(Counters::kInstructionDecodes, status);
+    return status;
   }
 
   ZyanStatus DecodeOperands(const ZydisDecodedInstruction* instruction, ZydisDecodedOperand* operands, ZyanU8 operand_count) {
@@ -25,7 +34,9 @@ class Decoder {
   }
 
   ZyanStatus DecodeFull(const void* buffer, ZyanISize buffer_size, ZydisDecodedInstruction* instruction, ZydisDecodedOperand* operands) {
-    return ZydisDecoderDecodeFull(&decoder_, buffer, buffer_size, instruction, operands);
+    ZyanStatus status = ZydisDecoderDecodeFull(&decoder_, buffer, buffer_size, instruction, operands);
+    CountDecode(Counters::kFullDecodes, status);
+    return status;
   }
 
   std::optional<uint64_t> DecodeImmValueS(std::span<const uint8_t> buffer, ZydisMnemonic mnemonic, ZyanU8 operand_index) {
@@ -107,21 +118,30 @@ class Decoder {
     return to;
   }
 
-  std::optional<uint64_t> CalcBackAddr(std::span<const uint8_t> buffer, uint64_t from, size_t min_bytes_size) {
+  // The sweeps below throw Cancelled once `stoken` is triggered. It is checked every 4096 decoded
+  // instructions.
+  std::optional<uint64_t> CalcBackAddr(std::span<const uint8_t> buffer, uint64_t from, size_t min_bytes_size, std::stop_token stoken = {}) {
     if (buffer.begin() >= buffer.end() || buffer.size() <= from) {
       return std::nullopt;
     }
 
     uint64_t to = from;
+    size_t count = 0;
+    std::optional<uint64_t> found;
     ZydisDecodedInstruction instruction;
     ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
     while (ZYAN_SUCCESS(DecodeFull(buffer.data() + to, buffer.size() - to, &instruction, operands))) {
+      if (++count % kStopCheckInterval == 0) {
+        ThrowIfStopRequested(stoken);
+      }
       to += instruction.length;
       if (to - from >= min_bytes_size) {
-        return to;
+        found = to;
+        break;
       }
     }
-    return std::nullopt;
+    ScanStatsScope::Record(to - from, count);
+    return found;
   }
 
   std::optional<uint64_t> CalcStackFrame(std::span<const uint8_t> buffer, size_t max_instructions = 20) {
@@ -183,26 +203,33 @@ class Decoder {
   template <typename Pred>
     requires std::is_invocable_v<Pred, const ZydisDecodedInstruction&> &&
              std::is_same_v<std::invoke_result_t<Pred, const ZydisDecodedInstruction&>, bool>
-  std::optional<uint64_t> FindIf(std::span<const uint8_t> buffer, uint64_t from, Pred&& pred) {
+  std::optional<uint64_t> FindIf(std::span<const uint8_t> buffer, uint64_t from, Pred&& pred, std::stop_token stoken = {}) {
     if (buffer.begin() >= buffer.end() || buffer.size() <= from) {
       return std::nullopt;
     }
 
     ZydisDecodedInstruction instruction;
     uint64_t to = from;
+    size_t count = 0;
+    std::optional<uint64_t> found;
     while (ZYAN_SUCCESS(DecodeInstruction(buffer.data() + to, buffer.size() - to, &instruction))) {
+      if (++count % kStopCheckInterval == 0) {
+        ThrowIfStopRequested(stoken);
+      }
       if (std::invoke(std::forward<Pred>(pred), instruction)) {
-        return to;
+        found = to;
+        break;
       }
       to += instruction.length;
     }
-    return std::nullopt;
+    ScanStatsScope::Record(to - from, count);
+    return found;
   }
 
   template <typename Pred>
     requires std::is_invocable_v<Pred, const ZydisDecodedInstruction&, const ZydisDecodedOperand[ZYDIS_MAX_OPERAND_COUNT]> &&
              std::is_same_v<std::invoke_result_t<Pred, const ZydisDecodedInstruction&, const ZydisDecodedOperand[ZYDIS_MAX_OPERAND_COUNT]>, bool>
-  std::optional<uint64_t> FindIf(std::span<const uint8_t> buffer, uint64_t from, Pred&& pred) {
+  std::optional<uint64_t> FindIf(std::span<const uint8_t> buffer, uint64_t from, Pred&& pred, std::stop_token stoken = {}) {
     if (buffer.begin() >= buffer.end()) {
       return std::nullopt;
     }
@@ -210,16 +237,30 @@ class Decoder {
     ZydisDecodedInstruction instruction;
     ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
     uint64_t to = from;
+    size_t count = 0;
+    std::optional<uint64_t> found;
     while (ZYAN_SUCCESS(DecodeFull(buffer.data() + to, buffer.size() - to, &instruction, operands))) {
+      if (++count % kStopCheckInterval == 0) {
+        ThrowIfStopRequested(stoken);
+      }
       if (std::invoke(std::forward<Pred>(pred), instruction, operands)) {
-        return to;
+        found = to;
+        break;
       }
       to += instruction.length;
     }
-    return std::nullopt;
+    ScanStatsScope::Record(to - from, count);
+    return found;
   }
 
  private:
+  static constexpr size_t kStopCheckInterval = 4096;
+
+  static void CountDecode(Counters::Id kind, ZyanStatus status) {
+    Counters::Add(kind, 1);
+    Counters::Add(ZYAN_SUCCESS(status) ? Counters::kDecodedInstructions : Counters::kDecodeFailures, 1);
+  }
+
   Decoder(const Decoder&) = delete;
   Decoder(Decoder&&) noexcept = delete;
   Decoder& operator=(const Decoder&) = delete;
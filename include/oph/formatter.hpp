@@ -1,88 +1,313 @@
 #pragma once
 
 // C++ standard
+#include <cstdint>
 #include <ostream>
+#include <ranges>
 #include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <vector>
 
 // Other library
-#include <fmt/args.h>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <fmt/ranges.h>
+
+// This project
+#include "json.hpp"
+#include "offset-table.hpp"
 
 namespace oph {
+// Outcome of one scan as handed to a formatter. `bytes` only refers to the result; nothing is copied.
+struct SlotValue {
+  enum Status {
+    kOk,
+    kError,
+    kTimeout,
+  };
+
+  Status status = kError;
+  bool is_bytes = false;
+  uint64_t offset = 0;
+  std::span<const uint8_t> bytes;
+};
+
+// Builds the output around the results of the scans, one slot per WriteOffset/WriteBytes, and
+// writes it piece by piece so it can be streamed while results are still coming in: ExportBegin
+// writes everything up to the first slot, ExportSlot the `index`th result and what follows it up to
+// the next slot, and ExportEnd the rest. Slots must be exported in order.
 class Formatter {
  public:
   virtual ~Formatter() {}
 
-  void WriteLineBreak() {
-    inner_format_.append("\n");
-  }
-
+  virtual void WriteLineBreak() = 0;
   virtual void WriteComment(std::string_view comment) = 0;
   virtual void WriteModule(std::string_view name, std::string_view version) = 0;
   virtual void WriteOffset(std::string_view name) = 0;
   virtual void WriteBytes(std::string_view name) = 0;
 
-  virtual std::string MakeOffset(uint64_t value) const = 0;
-  virtual std::string MakeBytes(std::span<const uint8_t> value) const = 0;
+  virtual void ExportBegin(std::ostream& os) = 0;
+  virtual void ExportSlot(std::ostream& os, size_t index, const SlotValue& value) = 0;
+  virtual void ExportEnd(std::ostream& os) = 0;
 
-  void Export(std::ostream& os, const std::vector<std::string>& args) {
-    fmt::dynamic_format_arg_store<fmt::format_context> arg_store;
-    arg_store.reserve(std::ranges::size(args), 0);
-    for (const auto& arg : args) {
-      arg_store.push_back(arg);
+  template <std::ranges::sized_range Range>
+  void Export(std::ostream& os, const Range& values) {
+    ExportBegin(os);
+    size_t index = 0;
+    for (const SlotValue& value : values) {
+      ExportSlot(os, index++, value);
     }
+    ExportEnd(os);
+  }
+};
+
+// Formatter of a text output. The template is kept split at its slots, so results never have to be
+// escaped into a format string and are written straight to the stream.
+class TextFormatter : public Formatter {
+ public:
+  virtual void WriteLineBreak() {
+    literals_.back().append("\n");
+  }
 
-    fmt::vprint(os, MakeFormat(), arg_store);
+  virtual void ExportBegin(std::ostream& os) {
+    os << MakeHeader() << literals_.front();
+  }
+
+  virtual void ExportSlot(std::ostream& os, size_t index, const SlotValue& value) {
+    if (value.status != SlotValue::kOk) {
+      FormatStatus(os, value.status);
+    } else if (value.is_bytes) {
+      FormatBytes(os, value.bytes);
+    } else {
+      FormatOffset(os, value.offset);
+    }
+    os << literals_[index + 1];
+  }
+
+  virtual void ExportEnd(std::ostream& os) {
+    os << MakeFooter();
   }
 
  protected:
-  std::string inner_format_;
+  // Ends the current literal; the result of the next slot goes between it and the following one.
+  void AddSlot() {
+    literals_.emplace_back();
+  }
+
+  std::vector<std::string> literals_ = std::vector<std::string>(1);
 
  private:
-  virtual std::string MakeFormat() const = 0;
+  virtual void FormatOffset(std::ostream& os, uint64_t value) const = 0;
+  virtual void FormatBytes(std::ostream& os, std::span<const uint8_t> value) const = 0;
+  virtual void FormatStatus(std::ostream& os, SlotValue::Status status) const = 0;
+  virtual std::string MakeHeader() const = 0;
+  virtual std::string MakeFooter() const { return {}; }
 };
 
-class CppFormatter : public Formatter {
+class CppFormatter : public TextFormatter {
  public:
   virtual void WriteComment(std::string_view comment) {
-    fmt::format_to(std::back_inserter(inner_format_), "// {}\n", comment);
+    fmt::format_to(std::back_inserter(literals_.back()), "// {}\n", comment);
   }
 
   virtual void WriteModule(std::string_view name, std::string_view version) {
-    fmt::format_to(std::back_inserter(inner_format_), "/* {} - {} ver */\n", name, version);
+    fmt::format_to(std::back_inserter(literals_.back()), "/* {} - {} ver */\n", name, version);
   }
 
   virtual void WriteOffset(std::string_view name) {
-    fmt::format_to(std::back_inserter(inner_format_), "constexpr uintptr_t {} = {{}};\n", name);
+    fmt::format_to(std::back_inserter(literals_.back()), "constexpr uintptr_t {} = ", name);
+    AddSlot();
+    literals_.back().append(";\n");
   }
 
   virtual void WriteBytes(std::string_view name) {
-    fmt::format_to(std::back_inserter(inner_format_), "constexpr uint8_t {}[] = {{}};\n", name);
+    fmt::format_to(std::back_inserter(literals_.back()), "constexpr uint8_t {}[] = ", name);
+    AddSlot();
+    literals_.back().append(";\n");
+  }
+
+ private:
+  virtual void FormatOffset(std::ostream& os, uint64_t value) const {
+    fmt::print(os, "0x{:X}", value);
   }
 
-  virtual std::string MakeOffset(uint64_t value) const {
-    return fmt::format("0x{:X}", value);
+  virtual void FormatBytes(std::ostream& os, std::span<const uint8_t> value) const {
+    fmt::print(os, "{{0x{:02X}}}", fmt::join(value, ", 0x"));
   }
 
-  virtual std::string MakeBytes(std::span<const uint8_t> value) const {
-    return fmt::format("{{0x{:02X}}}", fmt::join(value, ", 0x"));
+  virtual void FormatStatus(std::ostream& os, SlotValue::Status status) const {
+    os << (status == SlotValue::kTimeout ? "TIMEOUT" : "ERROR");
+  }
+
+  virtual std::string MakeHeader() const {
+    return "#pragma once\n"
+           "\n"
+           "// C++ standard\n"
+           "#include <cstdint>\n"
+           "\n";
+  }
+};
+
+// {"entries": [{"name", "module", "type", "status", "value"}, ...], "modules": [{"name", "version"}, ...]}
+//
+// Entries are in declaration order and carry the name of the module written before them. Offsets
+// are hex strings like the C++ output, since JSON parsers commonly read numbers as doubles and lose
+// precision above 2^53. Bytes are arrays of numbers, and values are null unless the status is "ok".
+// Comments and line breaks are dropped.
+class JsonFormatter : public TextFormatter {
+ public:
+  virtual void WriteLineBreak() {}
+
+  virtual void WriteComment(std::string_view) {}
+
+  virtual void WriteModule(std::string_view name, std::string_view version) {
+    fmt::format_to(std::back_inserter(modules_), "{}\n    {{\"name\": \"{}\", \"version\": \"{}\"}}", modules_.empty() ? "" : ",", EscapeJson(name), EscapeJson(version));
+    module_ = name;
+  }
+
+  virtual void WriteOffset(std::string_view name) {
+    WriteEntry(name, "offset");
+  }
+
+  virtual void WriteBytes(std::string_view name) {
+    WriteEntry(name, "bytes");
   }
 
  private:
-  virtual std::string MakeFormat() const {
-    static constexpr fmt::format_string<const std::string&> cpp_format =
-        "#pragma once\n"
-        "\n"
-        "// C++ standard\n"
-        "#include <cstdint>\n"
-        "\n"
-        "{}";
+  void WriteEntry(std::string_view name, std::string_view type) {
+    fmt::format_to(std::back_inserter(literals_.back()), "{}\n    {{\"name\": \"{}\", \"module\": \"{}\", \"type\": \"{}\", ",
+                   GetNumEntries() == 0 ? "" : ",", EscapeJson(name), EscapeJson(module_), type);
+    AddSlot();
+    literals_.back().append("}");
+  }
+
+  size_t GetNumEntries() const { return literals_.size() - 1; }
 
-    return fmt::format(cpp_format, inner_format_);
+  virtual void FormatOffset(std::ostream& os, uint64_t value) const {
+    fmt::print(os, "\"status\": \"ok\", \"value\": \"0x{:X}\"", value);
   }
+
+  virtual void FormatBytes(std::ostream& os, std::span<const uint8_t> value) const {
+    fmt::print(os, "\"status\": \"ok\", \"value\": [{}]", fmt::join(value, ", "));
+  }
+
+  virtual void FormatStatus(std::ostream& os, SlotValue::Status status) const {
+    fmt::print(os, "\"status\": \"{}\", \"value\": null", status == SlotValue::kTimeout ? "timeout" : "error");
+  }
+
+  virtual std::string MakeHeader() const {
+    return "{\n  \"entries\": [";
+  }
+
+  virtual std::string MakeFooter() const {
+    return fmt::format("\n  ],\n  \"modules\": [{}\n  ]\n}}\n", modules_);
+  }
+
+  std::string modules_;
+  std::string module_;
+};
+
+// Writes the table described in offset-table.hpp. The header, modules and names are known before
+// the first result, so only the entries and the data of byte entries are produced as results come in.
+class BinaryFormatter : public Formatter {
+ public:
+  virtual void WriteLineBreak() {}
+
+  virtual void WriteComment(std::string_view) {}
+
+  virtual void WriteModule(std::string_view name, std::string_view version) {
+    if (modules_.size() >= kNoModule) {
+      throw std::runtime_error(fmt::format("oph/formatter: more modules than an offset table can index: {}", modules_.size() + 1));
+    }
+
+    OffsetTableModule module = {};
+    module.name_offset = AddString(name);
+    module.name_size = (uint16_t)name.size();
+    module.version_offset = AddString(version);
+    module.version_size = (uint16_t)version.size();
+    modules_.push_back(module);
+  }
+
+  virtual void WriteOffset(std::string_view name) {
+    WriteEntry(name, OffsetTableEntry::kOffset);
+  }
+
+  virtual void WriteBytes(std::string_view name) {
+    WriteEntry(name, OffsetTableEntry::kBytes);
+  }
+
+  virtual void ExportBegin(std::ostream& os) {
+    OffsetTableHeader header = {};
+    header.magic = kOffsetTableMagic;
+    header.version = kOffsetTableVersion;
+    header.entry_size = sizeof(OffsetTableEntry);
+    header.num_entries = (uint32_t)entries_.size();
+    header.num_modules = (uint32_t)modules_.size();
+    header.modules_offset = sizeof(OffsetTableHeader) + entries_.size() * sizeof(OffsetTableEntry);
+    header.strings_offset = header.modules_offset + modules_.size() * sizeof(OffsetTableModule);
+    header.data_offset = header.strings_offset + strings_.size();
+    WriteRaw(os, header);
+
+    data_.clear();
+  }
+
+  virtual void ExportSlot(std::ostream& os, size_t index, const SlotValue& value) {
+    OffsetTableEntry entry = entries_[index];
+    entry.status = value.status == SlotValue::kOk ? OffsetTableEntry::kOk : value.status == SlotValue::kTimeout ? OffsetTableEntry::kTimeout : OffsetTableEntry::kError;
+    if (value.status == SlotValue::kOk) {
+      if (entry.type == OffsetTableEntry::kBytes) {
+        entry.value = data_.size();
+        entry.size = (uint32_t)value.bytes.size();
+        data_.insert(data_.end(), value.bytes.begin(), value.bytes.end());
+      } else {
+        entry.value = value.offset;
+      }
+    }
+    WriteRaw(os, entry);
+  }
+
+  virtual void ExportEnd(std::ostream& os) {
+    for (const auto& module : modules_) {
+      WriteRaw(os, module);
+    }
+    os.write(strings_.data(), strings_.size());
+    os.write(reinterpret_cast<const char*>(data_.data()), data_.size());
+  }
+
+ private:
+  void WriteEntry(std::string_view name, OffsetTableEntry::Type type) {
+    OffsetTableEntry entry = {};
+    entry.name_hash = HashName(name);
+    entry.name_offset = AddString(name);
+    entry.name_size = (uint16_t)name.size();
+    entry.module_index = modules_.empty() ? kNoModule : (uint16_t)(modules_.size() - 1);
+    entry.type = type;
+    entry.status = OffsetTableEntry::kError;
+    entries_.push_back(entry);
+  }
+
+  // Strings are referred to by a 32-bit offset and a 16-bit size, so longer ones would corrupt the
+  // table.
+  uint32_t AddString(std::string_view str) {
+    if (str.size() > UINT16_MAX || strings_.size() > UINT32_MAX) {
+      throw std::runtime_error(fmt::format("oph/formatter: string that does not fit in an offset table: {} bytes", str.size()));
+    }
+
+    uint32_t offset = (uint32_t)strings_.size();
+    strings_.append(str);
+    return offset;
+  }
+
+  template <typename T>
+  static void WriteRaw(std::ostream& os, const T& value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  std::vector<OffsetTableEntry> entries_;
+  std::vector<OffsetTableModule> modules_;
+  std::string strings_;
+  std::vector<uint8_t> data_;
 };
 }  // namespace oph
@@ -0,0 +1,232 @@
+#pragma once
+
+// C++ standard
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+// This project
+#include "slab-allocator.hpp"
+
+namespace oph {
+// State shared by one Promise and one Future, allocated from the pool's SlabAllocator. Waiting uses
+// `std::atomic::wait`, so there is no mutex or condition variable to set up per result. A coroutine
+// awaiting the Future parks its handle here instead and is resumed by whoever sets the result.
+template <typename T>
+class SharedState {
+ public:
+  using ValueType = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  SharedState(SlabAllocator* slab) : refs_(2), status_(kPending), waiter_(kNoWaiter), slab_(slab) {}
+
+  ~SharedState() {
+    if (status_.load(std::memory_order_relaxed) == kValue) {
+      value_.~ValueType();
+    }
+  }
+
+  template <typename... Args>
+  void SetValue(Args&&... args) {
+    new (&value_) ValueType(std::forward<Args>(args)...);
+    Publish(kValue);
+  }
+
+  void SetException(std::exception_ptr exception) {
+    exception_ = std::move(exception);
+    Publish(kException);
+  }
+
+  bool IsReady() const {
+    return status_.load(std::memory_order_acquire) != kPending;
+  }
+
+  void Wait() const {
+    while (status_.load(std::memory_order_acquire) == kPending) {
+      status_.wait(kPending, std::memory_order_acquire);
+    }
+  }
+
+  // Returns false if the result was already set, in which case `handle` must not suspend.
+  bool Suspend(std::coroutine_handle<> handle) {
+    continuation_ = handle;
+    uint32_t expected = kNoWaiter;
+    return waiter_.compare_exchange_strong(expected, kWaiting, std::memory_order_acq_rel);
+  }
+
+  ValueType TakeValue() {
+    if (status_.load(std::memory_order_acquire) == kException) {
+      std::rethrow_exception(exception_);
+    }
+    return std::move(value_);
+  }
+
+  void Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      slab_->Delete(this);
+    }
+  }
+
+ private:
+  enum Status : uint32_t {
+    kPending,
+    kValue,
+    kException,
+  };
+
+  enum Waiter : uint32_t {
+    kNoWaiter,
+    kWaiting,
+    kPublished,
+  };
+
+  SharedState(const SharedState&) = delete;
+  SharedState(SharedState&&) noexcept = delete;
+  SharedState& operator=(const SharedState&) = delete;
+  SharedState& operator=(SharedState&&) noexcept = delete;
+
+  void Publish(Status status) {
+    status_.store(status, std::memory_order_release);
+    status_.notify_all();
+    if (waiter_.exchange(kPublished, std::memory_order_acq_rel) == kWaiting) {
+      continuation_.resume();
+    }
+  }
+
+  std::atomic_uint32_t refs_;
+  std::atomic_uint32_t status_;
+  std::atomic_uint32_t waiter_;
+  std::coroutine_handle<> continuation_;
+  SlabAllocator* slab_;
+  std::exception_ptr exception_;
+  union {
+    ValueType value_;
+  };
+};
+
+template <typename T>
+class Future {
+ public:
+  Future() : state_(nullptr) {}
+
+  explicit Future(SharedState<T>* state) : state_(state) {}
+
+  Future(Future&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+
+  Future& operator=(Future&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      state_ = std::exchange(other.state_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Future() {
+    Reset();
+  }
+
+  bool Valid() const { return state_ != nullptr; }
+
+  bool IsReady() const { return state_->IsReady(); }
+
+  void Wait() const {
+    state_->Wait();
+  }
+
+  // Lets a coroutine wait for the result without blocking its thread. It is resumed on the thread
+  // that sets the result.
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return future.IsReady(); }
+
+      bool await_suspend(std::coroutine_handle<> handle) { return future.state_->Suspend(handle); }
+
+      T await_resume() { return future.Get(); }
+
+      Future& future;
+    };
+    return Awaiter{*this};
+  }
+
+  T Get() {
+    state_->Wait();
+
+    // Released on every path, including the one where the stored exception is rethrown.
+    struct Releaser {
+      SharedState<T>* state;
+      ~Releaser() { state->Release(); }
+    } releaser{std::exchange(state_, nullptr)};
+
+    if constexpr (std::is_void_v<T>) {
+      releaser.state->TakeValue();
+    } else {
+      return releaser.state->TakeValue();
+    }
+  }
+
+ private:
+  Future(const Future&) = delete;
+  Future& operator=(const Future&) = delete;
+
+  void Reset() {
+    if (state_ != nullptr) {
+      std::exchange(state_, nullptr)->Release();
+    }
+  }
+
+  SharedState<T>* state_;
+};
+
+template <typename T>
+class Promise {
+ public:
+  explicit Promise(SharedState<T>* state) : state_(state) {}
+
+  Promise(Promise&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+
+  Promise& operator=(Promise&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      state_ = std::exchange(other.state_, nullptr);
+    }
+    return *this;
+  }
+
+  ~Promise() {
+    Reset();
+  }
+
+  template <typename... Args>
+  void SetValue(Args&&... args) {
+    state_->SetValue(std::forward<Args>(args)...);
+    std::exchange(state_, nullptr)->Release();
+  }
+
+  void SetException(std::exception_ptr exception) {
+    state_->SetException(std::move(exception));
+    std::exchange(state_, nullptr)->Release();
+  }
+
+ private:
+  Promise(const Promise&) = delete;
+  Promise& operator=(const Promise&) = delete;
+
+  void Reset() {
+    if (state_ != nullptr) {
+      SetException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+  }
+
+  SharedState<T>* state_;
+};
+
+template <typename T>
+std::pair<Promise<T>, Future<T>> MakePromise(SlabAllocator* slab) {
+  auto state = slab->New<SharedState<T>>(slab);
+  return {Promise<T>(state), Future<T>(state)};
+}
+}  // namespace oph
@@ -0,0 +1,240 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace oph {
+// Where a section lies in an image, relative to its base.
+struct SectionLayout {
+  std::string name;
+  uint64_t rva;
+  uint64_t size;
+};
+
+// Part of an image that the loader fills from the file: [rva, rva + memsz) of which the first
+// `filesz` bytes come from `file_offset` and the rest is zero-filled.
+struct SegmentLayout {
+  uint64_t rva;
+  uint64_t memsz;
+  uint64_t file_offset;
+  uint64_t filesz;
+};
+
+// The headers of a PE or little-endian ELF32/ELF64 file that say how it is laid out in memory. They
+// are read field by field, so nothing here depends on Windows.h or on the host's struct layout.
+//
+// Only the headers themselves are bounds-checked: the raw data a segment points at may lie past the
+// end of `data`, e.g. in a dump of a loaded module, so whoever reads it checks that.
+struct ImageHeaders {
+  enum Format {
+    kPE,
+    kELF,
+  };
+
+  // Larger images are taken for corrupt headers rather than allocated.
+  static constexpr uint64_t kMaxImageSize = 1ull << 32;
+
+  Format format;
+  // ImageBase for PE, the first loadable segment's address rounded down to its alignment for ELF.
+  uint64_t image_base;
+  uint64_t image_size;
+  // Bytes at the start of the file that are mapped at the image base, besides the segments.
+  uint64_t headers_size;
+  // PE sections or ELF loadable segments.
+  std::vector<SegmentLayout> segments;
+  // Allocated sections, named after the section headers. A stripped ELF file has none.
+  std::vector<SectionLayout> sections;
+
+  static std::optional<ImageHeaders> Parse(std::span<const uint8_t> data) {
+    auto headers = ParsePE(data);
+    if (!headers.has_value()) {
+      headers = ParseELF(data);
+    }
+    return headers;
+  }
+
+ private:
+  template <typename T>
+  static std::optional<T> Read(std::span<const uint8_t> data, uint64_t offset) {
+    if (offset > data.size() || sizeof(T) > data.size() - offset) {
+      return std::nullopt;
+    }
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+  }
+
+  // Addresses, offsets and sizes in ELF headers are as wide as the file class.
+  static std::optional<uint64_t> ReadElfWord(std::span<const uint8_t> data, uint64_t offset, bool is_64) {
+    if (is_64) {
+      return Read<uint64_t>(data, offset);
+    }
+    auto value = Read<uint32_t>(data, offset);
+    if (!value.has_value()) {
+      return std::nullopt;
+    }
+    return value.value();
+  }
+
+  // Whether [rva, rva + size) lies in an image of `image_size` bytes.
+  static bool Fits(uint64_t rva, uint64_t size, uint64_t image_size) {
+    return rva <= image_size && size <= image_size - rva;
+  }
+
+  static std::optional<ImageHeaders> ParsePE(std::span<const uint8_t> data) {
+    constexpr uint16_t kDosSignature = 0x5A4D;  // MZ
+    constexpr uint32_t kNtSignature = 0x4550;   // PE\0\0
+    constexpr uint16_t kMagic32 = 0x10B;
+    constexpr uint16_t kMagic64 = 0x20B;
+    constexpr uint64_t kFileHeaderSize = 20;
+    constexpr uint64_t kSectionHeaderSize = 40;
+    constexpr size_t kShortNameSize = 8;
+
+    auto dos_signature = Read<uint16_t>(data, 0);
+    auto nt_offset = Read<int32_t>(data, 0x3C);
+    if (!dos_signature || !nt_offset || dos_signature.value() != kDosSignature || nt_offset.value() < 0) {
+      return std::nullopt;
+    }
+
+    uint64_t file_header = (uint64_t)nt_offset.value() + 4;
+    uint64_t optional_header = file_header + kFileHeaderSize;
+    auto nt_signature = Read<uint32_t>(data, nt_offset.value());
+    auto num_sections = Read<uint16_t>(data, file_header + 2);
+    auto optional_header_size = Read<uint16_t>(data, file_header + 16);
+    auto magic = Read<uint16_t>(data, optional_header);
+    if (!nt_signature || !num_sections || !optional_header_size || !magic || nt_signature.value() != kNtSignature ||
+        (magic.value() != kMagic32 && magic.value() != kMagic64)) {
+      return std::nullopt;
+    }
+
+    std::optional<uint64_t> image_base;
+    if (magic.value() == kMagic64) {
+      image_base = Read<uint64_t>(data, optional_header + 24);
+    } else if (auto image_base32 = Read<uint32_t>(data, optional_header + 28)) {
+      image_base = image_base32.value();
+    }
+    auto image_size = Read<uint32_t>(data, optional_header + 56);
+    auto headers_size = Read<uint32_t>(data, optional_header + 60);
+    if (!image_base || !image_size || !headers_size || image_size.value() > kMaxImageSize) {
+      return std::nullopt;
+    }
+
+    ImageHeaders headers{kPE, image_base.value(), image_size.value(), headers_size.value(), {}, {}};
+    uint64_t section_header = optional_header + optional_header_size.value();
+    for (uint16_t i = 0; i < num_sections.value(); i++, section_header += kSectionHeaderSize) {
+      auto name = Read<std::array<char, kShortNameSize>>(data, section_header);
+      auto virtual_size = Read<uint32_t>(data, section_header + 8);
+      auto rva = Read<uint32_t>(data, section_header + 12);
+      auto raw_size = Read<uint32_t>(data, section_header + 16);
+      auto raw_offset = Read<uint32_t>(data, section_header + 20);
+      if (!name || !virtual_size || !rva || !raw_size || !raw_offset || !Fits(rva.value(), virtual_size.value(), headers.image_size)) {
+        return std::nullopt;
+      }
+
+      auto name_end = std::ranges::find(name.value(), '\0');
+      headers.sections.push_back({std::string(name->begin(), name_end), rva.value(), virtual_size.value()});
+      headers.segments.push_back({rva.value(), virtual_size.value(), raw_offset.value(), std::min(raw_size.value(), virtual_size.value())});
+    }
+    return headers;
+  }
+
+  static std::optional<ImageHeaders> ParseELF(std::span<const uint8_t> data) {
+    constexpr uint8_t kMagic[] = {0x7F, 'E', 'L', 'F'};
+    constexpr uint8_t kClass32 = 1;
+    constexpr uint8_t kClass64 = 2;
+    constexpr uint8_t kLittleEndian = 1;
+    constexpr uint32_t kLoad = 1;
+    constexpr uint64_t kAlloc = 0x2;
+
+    if (data.size() < 16 || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0 || data[5] != kLittleEndian ||
+        (data[4] != kClass32 && data[4] != kClass64)) {
+      return std::nullopt;
+    }
+
+    bool is_64 = data[4] == kClass64;
+    auto ph_offset = ReadElfWord(data, is_64 ? 0x20 : 0x1C, is_64);
+    auto sh_offset = ReadElfWord(data, is_64 ? 0x28 : 0x20, is_64);
+    auto ph_entry_size = Read<uint16_t>(data, is_64 ? 0x36 : 0x2A);
+    auto ph_count = Read<uint16_t>(data, is_64 ? 0x38 : 0x2C);
+    auto sh_entry_size = Read<uint16_t>(data, is_64 ? 0x3A : 0x2E);
+    auto sh_count = Read<uint16_t>(data, is_64 ? 0x3C : 0x30);
+    auto sh_names_index = Read<uint16_t>(data, is_64 ? 0x3E : 0x32);
+    if (!ph_offset || !sh_offset || !ph_entry_size || !ph_count || !sh_entry_size || !sh_count || !sh_names_index) {
+      return std::nullopt;
+    }
+
+    ImageHeaders headers{kELF, 0, 0, 0, {}, {}};
+    std::optional<uint64_t> image_base;
+    uint64_t image_end = 0;
+    for (uint16_t i = 0; i < ph_count.value(); i++) {
+      uint64_t header = ph_offset.value() + (uint64_t)i * ph_entry_size.value();
+      auto type = Read<uint32_t>(data, header);
+      auto offset = ReadElfWord(data, header + (is_64 ? 0x08 : 0x04), is_64);
+      auto vaddr = ReadElfWord(data, header + (is_64 ? 0x10 : 0x08), is_64);
+      auto filesz = ReadElfWord(data, header + (is_64 ? 0x20 : 0x10), is_64);
+      auto memsz = ReadElfWord(data, header + (is_64 ? 0x28 : 0x14), is_64);
+      auto align = ReadElfWord(data, header + (is_64 ? 0x30 : 0x1C), is_64);
+      if (!type || !offset || !vaddr || !filesz || !memsz || !align) {
+        return std::nullopt;
+      }
+      if (type.value() != kLoad) {
+        continue;
+      }
+
+      if (!image_base.has_value()) {
+        image_base = align.value() > 1 ? vaddr.value() & ~(align.value() - 1) : vaddr.value();
+      }
+      if (vaddr.value() < image_base.value() || filesz.value() > memsz.value() || memsz.value() > UINT64_MAX - vaddr.value() ||
+          vaddr.value() + memsz.value() - image_base.value() > kMaxImageSize) {
+        return std::nullopt;
+      }
+      image_end = std::max(image_end, vaddr.value() + memsz.value());
+      headers.segments.push_back({vaddr.value() - image_base.value(), memsz.value(), offset.value(), filesz.value()});
+    }
+    if (!image_base.has_value()) {
+      return std::nullopt;
+    }
+
+    headers.image_base = image_base.value();
+    headers.image_size = image_end - image_base.value();
+
+    if (sh_offset.value() != 0 && sh_names_index.value() < sh_count.value()) {
+      uint64_t names_header = sh_offset.value() + (uint64_t)sh_names_index.value() * sh_entry_size.value();
+      auto names_offset = ReadElfWord(data, names_header + (is_64 ? 0x18 : 0x10), is_64);
+      auto names_size = ReadElfWord(data, names_header + (is_64 ? 0x20 : 0x14), is_64);
+      if (!names_offset || !names_size || !Fits(names_offset.value(), names_size.value(), data.size())) {
+        return std::nullopt;
+      }
+      auto names = std::string_view((const char*)data.data() + names_offset.value(), names_size.value());
+
+      for (uint16_t i = 0; i < sh_count.value(); i++) {
+        uint64_t header = sh_offset.value() + (uint64_t)i * sh_entry_size.value();
+        auto name = Read<uint32_t>(data, header);
+        auto flags = ReadElfWord(data, header + 0x08, is_64);
+        auto addr = ReadElfWord(data, header + (is_64 ? 0x10 : 0x0C), is_64);
+        auto size = ReadElfWord(data, header + (is_64 ? 0x20 : 0x14), is_64);
+        if (!name || !flags || !addr || !size || name.value() >= names.size()) {
+          return std::nullopt;
+        }
+        if (!(flags.value() & kAlloc) || addr.value() < image_base.value() ||
+            !Fits(addr.value() - image_base.value(), size.value(), headers.image_size)) {
+          continue;
+        }
+
+        auto section_name = names.substr(name.value(), names.find('\0', name.value()) - name.value());
+        headers.sections.push_back({std::string(section_name), addr.value() - image_base.value(), size.value()});
+      }
+    }
+    return headers;
+  }
+};
+}  // namespace oph
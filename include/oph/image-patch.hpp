@@ -0,0 +1,252 @@
+#pragma once
+
+// C standard
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // _WIN32
+
+// C++ standard
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// This project
+#include "image-headers.hpp"
+
+namespace oph {
+// Bytes to write at `address`, e.g. a WriteBytes result. If `expected` is not empty, the patch is
+// only applied if the bytes there are exactly `expected`, which must then be as long as `bytes`.
+struct BytePatch {
+  uint64_t address;
+  std::vector<uint8_t> bytes;
+  std::vector<uint8_t> expected;
+};
+
+// A PE or ELF file mapped into memory for writing (MapViewOfFile on Windows, mmap elsewhere), so
+// patching it only touches the pages that change instead of rewriting the whole file.
+class MappedImage {
+ public:
+  using Format = ImageHeaders::Format;
+  static constexpr Format kPE = ImageHeaders::kPE;
+  static constexpr Format kELF = ImageHeaders::kELF;
+
+  explicit MappedImage(const std::string& file_path) {
+    Map(file_path);
+
+    auto headers = ImageHeaders::Parse(data_);
+    if (!headers.has_value() || !AddRegions(headers.value())) {
+      Close();
+      throw std::runtime_error(std::format("oph/image-patch: file that is neither PE nor ELF: {}", file_path));
+    }
+  }
+
+  ~MappedImage() {
+    Close();
+  }
+
+  Format GetFormat() const { return format_; }
+
+  // Address the file expects to be loaded at: ImageBase for PE, the start of the first loadable
+  // segment for ELF, which is 0 for position-independent files.
+  uint64_t GetImageBase() const { return image_base_; }
+
+  std::span<const uint8_t> GetData() const { return data_; }
+
+  // File offset of `size` bytes at `address` of the image loaded at `base_addr`, or nullopt if they
+  // are not all backed by the raw data of one section (PE) or loadable segment (ELF).
+  std::optional<uint64_t> ToFileOffset(uint64_t address, uint64_t size, uint64_t base_addr) const {
+    uint64_t va = address - base_addr + image_base_;
+    for (const auto& region : regions_) {
+      if (va >= region.va && va - region.va <= region.size && size <= region.size - (va - region.va)) {
+        return region.file_offset + (va - region.va);
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::optional<uint64_t> ToFileOffset(uint64_t address, uint64_t size) const {
+    return ToFileOffset(address, size, image_base_);
+  }
+
+  // Applies every patch or none of them. Addresses are those of the image loaded at `base_addr`,
+  // e.g. Module::GetBaseAddr() of the dump the offsets were found in. All of them are translated
+  // and checked against `expected` before anything is written, and if the changes cannot be
+  // flushed to the file the original bytes are put back. That rollback only covers a failed flush:
+  // a fault while writing to the mapping itself (EXCEPTION_IN_PAGE_ERROR or SIGBUS, e.g. a full
+  // disk under a sparse file) ends the process with the patches up to it applied.
+  //
+  // Returns the patches that undo this one, which can be applied the same way.
+  std::vector<BytePatch> Apply(std::span<const BytePatch> patches, uint64_t base_addr) {
+    struct Write {
+      uint64_t file_offset;
+      const BytePatch* patch;
+    };
+
+    std::vector<Write> writes;
+    writes.reserve(patches.size());
+    for (const auto& patch : patches) {
+      if (!patch.expected.empty() && patch.expected.size() != patch.bytes.size()) {
+        throw std::runtime_error(std::format("oph/image-patch: expected bytes of unexpected size at {:x}", patch.address));
+      }
+
+      auto file_offset = ToFileOffset(patch.address, patch.bytes.size(), base_addr);
+      if (!file_offset.has_value()) {
+        throw std::runtime_error(std::format("oph/image-patch: address that is not backed by the file: {:x}", patch.address));
+      }
+      if (!patch.expected.empty() && std::memcmp(view_ + file_offset.value(), patch.expected.data(), patch.expected.size()) != 0) {
+        throw std::runtime_error(std::format("oph/image-patch: original bytes that do not match at {:x}", patch.address));
+      }
+      writes.push_back({file_offset.value(), &patch});
+    }
+
+    std::ranges::sort(writes, {}, &Write::file_offset);
+    for (size_t i = 1; i < writes.size(); i++) {
+      if (writes[i - 1].file_offset + writes[i - 1].patch->bytes.size() > writes[i].file_offset) {
+        throw std::runtime_error(std::format("oph/image-patch: patches that overlap at {:x}", writes[i].patch->address));
+      }
+    }
+
+    std::vector<BytePatch> undo;
+    undo.reserve(writes.size());
+    for (const auto& write : writes) {
+      auto original = data_.subspan(write.file_offset, write.patch->bytes.size());
+      undo.push_back({write.patch->address, std::vector<uint8_t>(original.begin(), original.end()), write.patch->bytes});
+    }
+
+    for (const auto& write : writes) {
+      std::memcpy(view_ + write.file_offset, write.patch->bytes.data(), write.patch->bytes.size());
+    }
+    if (!Flush()) {
+      for (size_t i = 0; i < writes.size(); i++) {
+        std::memcpy(view_ + writes[i].file_offset, undo[i].bytes.data(), undo[i].bytes.size());
+      }
+      Flush();
+      throw std::runtime_error("oph/image-patch: changes that cannot be written to the file, rolled back");
+    }
+    return undo;
+  }
+
+  std::vector<BytePatch> Apply(std::span<const BytePatch> patches) {
+    return Apply(patches, image_base_);
+  }
+
+ private:
+  MappedImage(const MappedImage&) = delete;
+  MappedImage(MappedImage&&) noexcept = delete;
+  MappedImage& operator=(const MappedImage&) = delete;
+  MappedImage& operator=(MappedImage&&) noexcept = delete;
+
+  // Part of the file that is mapped to [va, va + size) when the image is loaded at its image base.
+  struct Region {
+    uint64_t va;
+    uint64_t size;
+    uint64_t file_offset;
+  };
+
+  // Only the part of a section or segment that is in the file can be patched; the rest is zero-filled.
+  bool AddRegions(const ImageHeaders& headers) {
+    for (const auto& segment : headers.segments) {
+      if (segment.file_offset > data_.size() || segment.filesz > data_.size() - segment.file_offset) {
+        return false;
+      }
+      if (segment.filesz != 0) {
+        regions_.push_back({headers.image_base + segment.rva, segment.filesz, segment.file_offset});
+      }
+    }
+    format_ = headers.format;
+    image_base_ = headers.image_base;
+    return true;
+  }
+
+#ifdef _WIN32
+  void Map(const std::string& file_path) {
+    file_handle_ = CreateFileA(file_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle_ == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error(std::format("oph/image-patch: file that cannot be opened: {}", file_path));
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle_, &file_size) || file_size.QuadPart == 0 ||
+        (mapping_handle_ = CreateFileMappingA(file_handle_, NULL, PAGE_READWRITE, 0, 0, NULL)) == NULL ||
+        (view_ = (uint8_t*)MapViewOfFile(mapping_handle_, FILE_MAP_WRITE, 0, 0, 0)) == nullptr) {
+      Close();
+      throw std::runtime_error(std::format("oph/image-patch: file that cannot be mapped: {}", file_path));
+    }
+    data_ = {view_, (size_t)file_size.QuadPart};
+  }
+
+  bool Flush() {
+    return FlushViewOfFile(view_, 0) && FlushFileBuffers(file_handle_);
+  }
+
+  void Close() {
+    if (view_ != nullptr) {
+      UnmapViewOfFile(view_);
+      view_ = nullptr;
+    }
+    if (mapping_handle_ != NULL) {
+      CloseHandle(mapping_handle_);
+      mapping_handle_ = NULL;
+    }
+    if (file_handle_ != INVALID_HANDLE_VALUE) {
+      CloseHandle(file_handle_);
+      file_handle_ = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  HANDLE file_handle_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_handle_ = NULL;
+#else
+  void Map(const std::string& file_path) {
+    fd_ = open(file_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ == -1) {
+      throw std::runtime_error(std::format("oph/image-patch: file that cannot be opened: {}", file_path));
+    }
+
+    struct stat file_stat;
+    void* view;
+    if (fstat(fd_, &file_stat) != 0 || file_stat.st_size == 0 ||
+        (view = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0)) == MAP_FAILED) {
+      Close();
+      throw std::runtime_error(std::format("oph/image-patch: file that cannot be mapped: {}", file_path));
+    }
+    view_ = (uint8_t*)view;
+    data_ = {view_, (size_t)file_stat.st_size};
+  }
+
+  bool Flush() {
+    return msync(view_, data_.size(), MS_SYNC) == 0;
+  }
+
+  void Close() {
+    if (view_ != nullptr) {
+      munmap(view_, data_.size());
+      view_ = nullptr;
+    }
+    if (fd_ != -1) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  int fd_ = -1;
+#endif  // _WIN32
+  uint8_t* view_ = nullptr;
+  std::span<uint8_t> data_;
+  Format format_ = kPE;
+  uint64_t image_base_ = 0;
+  std::vector<Region> regions_;
+};
+}  // namespace oph
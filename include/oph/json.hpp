@@ -0,0 +1,29 @@
+#pragma once
+
+// C++ standard
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+// Other library
+#include <fmt/format.h>
+
+namespace oph {
+// `str` with quotes, backslashes and control characters escaped, to be put between quotes in JSON.
+inline std::string EscapeJson(std::string_view str) {
+  std::string escaped;
+  escaped.reserve(str.size());
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if ((uint8_t)c < 0x20) {
+      fmt::format_to(std::back_inserter(escaped), "\\u{:04x}", (uint8_t)c);
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+}  // namespace oph
@@ -1,21 +1,35 @@
 #pragma once
 
+#ifdef _WIN32
 // C standard
 #include <Windows.h>
 // Redefinition guard
 #include <TlHelp32.h>
+#endif  // _WIN32
 
 // C++ standard
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <format>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-#ifdef UNICODE
+// This project
+#include "image-headers.hpp"
+#include "thread-pool.hpp"
+
+#if defined(_WIN32) && defined(UNICODE)
 #undef Process32First
 #undef Process32Next
 #undef PROCESSENTRY32
@@ -78,37 +92,13 @@ class Module {
   Module& operator=(const Module&) = delete;
   Module& operator=(Module&&) noexcept = delete;
 
-  Module(const std::string& version, uint64_t base_addr, std::vector<uint8_t>&& dump)
+  Module(const std::string& version, uint64_t base_addr, std::vector<uint8_t>&& dump, const std::vector<SectionLayout>& layouts)
       : version_(version), base_addr_(base_addr), dump_(std::move(dump)) {
-    const uint8_t* data = dump_.data();
-    auto nt_header = (PIMAGE_NT_HEADERS)(data + ((PIMAGE_DOS_HEADER)data)->e_lfanew);
-
-    size_t optional_header_offset;
-    if (nt_header->FileHeader.Machine == IMAGE_FILE_MACHINE_AMD64) {
-      optional_header_offset = FIELD_OFFSET(IMAGE_NT_HEADERS64, OptionalHeader);
-    } else {
-      optional_header_offset = FIELD_OFFSET(IMAGE_NT_HEADERS32, OptionalHeader);
-    }
-
-    auto section_header =
-        (PIMAGE_SECTION_HEADER)((uintptr_t)nt_header +
-                                optional_header_offset +
-                                nt_header->FileHeader.SizeOfOptionalHeader);
-
-    for (int i = 0; i < nt_header->FileHeader.NumberOfSections; i++, section_header++) {
-      const char* section_name = (const char*)section_header->Name;
-      size_t section_name_size = [](const char* str) {
-        size_t n = 0;
-        for (; n < IMAGE_SIZEOF_SHORT_NAME && str[n] != '\0'; n++);
-        return n;
-      }(section_name);
-
-      uint64_t section_rva = section_header->VirtualAddress;
-      auto section_data = std::span<const uint8_t>(dump_).subspan(section_rva, section_header->Misc.VirtualSize);
-
+    for (const auto& layout : layouts) {
+      auto section_data = std::span<const uint8_t>(dump_).subspan(layout.rva, layout.size);
       sections_.emplace(std::piecewise_construct,
-                        std::forward_as_tuple(section_name, section_name_size),
-                        std::forward_as_tuple(base_addr_ + section_rva, section_rva, section_data));
+                        std::forward_as_tuple(layout.name),
+                        std::forward_as_tuple(base_addr_ + layout.rva, layout.rva, section_data));
     }
   }
 
@@ -122,26 +112,112 @@ class DumpStore {
  public:
   DumpStore() {}
 
+#ifdef _WIN32
   void DumpModule(const std::string& process_name, const std::vector<std::string>& module_names = {}) {
     DWORD process_id = GetProcessId(process_name);
     if (process_id == 0) {
       return;
     }
 
-    HANDLE process_handle = OpenProcess(PROCESS_VM_READ, FALSE, process_id);
-    if (process_handle != INVALID_HANDLE_VALUE) {
-      HANDLE snapshot_handle = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, process_id);
-      if (snapshot_handle != INVALID_HANDLE_VALUE) {
-        DumpModule(process_handle, snapshot_handle, process_name);
-        for (const auto& module_name : module_names) {
-          DumpModule(process_handle, snapshot_handle, module_name);
+    UniqueHandle process_handle(OpenProcess(PROCESS_VM_READ, FALSE, process_id));
+    if (process_handle != nullptr) {
+      auto module_entries = GetModuleEntries(process_id);
+      auto dump_module = [&](const std::string& module_name) {
+        auto iter = module_entries.find(module_name);
+        if (iter == module_entries.end()) {
+          return;
+        }
+
+        auto module_dump = ReadModule(process_handle.get(), iter->second);
+        if (module_dump.has_value()) {
+          EmplaceModule(module_name, std::move(module_dump.value()));
+        }
+      };
+
+      dump_module(process_name);
+      for (const auto& module_name : module_names) {
+        dump_module(module_name);
+      }
+    }
+  }
+
+  void DumpModule(ThreadPool& pool, const std::string& process_name, const std::vector<std::string>& module_names = {}) {
+    DumpModule(pool, {{process_name, module_names}});
+  }
+
+  // Dumps the modules of several processes at once. Each process's module list is walked
+  // only once and the module reads run concurrently on `pool`. When the same module name
+  // shows up in more than one process, the first one in `targets` is kept.
+  void DumpModule(ThreadPool& pool, const std::vector<std::pair<std::string, std::vector<std::string>>>& targets) {
+    auto process_ids = GetProcessIds();
+
+    // Declared first so the handles are closed last, after the futures that read through them.
+    std::vector<UniqueHandle> process_handles;
+    std::vector<std::pair<std::string, Future<std::optional<ModuleDump>>>> module_dumps;
+    std::unordered_set<std::string> queued_names;
+    for (const auto& [process_name, module_names] : targets) {
+      auto process_iter = process_ids.find(process_name);
+      if (process_iter == process_ids.end()) {
+        continue;
+      }
+
+      HANDLE process_handle = OpenProcess(PROCESS_VM_READ, FALSE, process_iter->second);
+      if (process_handle == NULL) {
+        continue;
+      }
+      process_handles.emplace_back(process_handle);
+
+      auto module_entries = GetModuleEntries(process_iter->second);
+      auto queue_module = [&](const std::string& module_name) {
+        auto iter = module_entries.find(module_name);
+        if (iter == module_entries.end() || Contains(module_name) || !queued_names.insert(module_name).second) {
+          return;
         }
+        module_dumps.emplace_back(module_name, pool.Enqueue(&DumpStore::ReadModule, process_handle, iter->second));
+      };
+
+      queue_module(process_name);
+      for (const auto& module_name : module_names) {
+        queue_module(module_name);
+      }
+    }
 
-        CloseHandle(snapshot_handle);
+    // Every read finishes first, so a Get() that throws cannot close a handle that is still in use.
+    for (const auto& [module_name, module_dump] : module_dumps) {
+      module_dump.Wait();
+    }
+    for (auto& [module_name, module_dump] : module_dumps) {
+      auto result = module_dump.Get();
+      if (result.has_value()) {
+        EmplaceModule(module_name, std::move(result.value()));
       }
-      CloseHandle(process_handle);
     }
   }
+#endif  // _WIN32
+
+  // Loads a PE or ELF file from disk and lays its sections out the way the loader maps them, so
+  // offsets found in it match a dump of the running module. An archived build has no process to ask
+  // for its version, so `version` is given.
+  void LoadModule(const std::string& module_name, const std::string& file_path, const std::string& version) {
+    auto file = ReadFile(file_path);
+    auto image = MapImage(file);
+    if (!image.has_value()) {
+      throw std::runtime_error(std::format("oph/memory: file that is neither PE nor ELF: {}", file_path));
+    }
+    image->version = version;
+    EmplaceModule(module_name, std::move(image.value()));
+  }
+
+  // Loads a module that was dumped from memory as-is, e.g. Module::GetDump() written to a file, at
+  // the base address it was dumped from.
+  void LoadSnapshot(const std::string& module_name, const std::string& file_path, uint64_t base_addr, const std::string& version) {
+    auto dump = ReadFile(file_path);
+    auto sections = GetSectionLayouts(dump);
+    if (!sections.has_value()) {
+      throw std::runtime_error(std::format("oph/memory: invalid module snapshot: {}", file_path));
+    }
+    EmplaceModule(module_name, {version, base_addr, std::move(dump), std::move(sections.value())});
+  }
 
   bool Contains(const std::string& module_name) const {
     auto iter = modules_.find(module_name);
@@ -175,26 +251,117 @@ class DumpStore {
   DumpStore& operator=(const DumpStore&) = delete;
   DumpStore& operator=(DumpStore&&) noexcept = delete;
 
-  void DumpModule(const HANDLE process_handle, const HANDLE snapshot_handle, const std::string& module_name) {
-    MODULEENTRY32 me32;
-    me32.dwSize = sizeof(MODULEENTRY32);
+#ifdef _WIN32
+  struct HandleCloser {
+    void operator()(HANDLE handle) const { CloseHandle(handle); }
+  };
+  using UniqueHandle = std::unique_ptr<void, HandleCloser>;
+#endif  // _WIN32
+
+  struct ModuleDump {
+    std::string version;
+    uint64_t base_addr;
+    std::vector<uint8_t> dump;
+    std::vector<SectionLayout> sections;
+  };
+
+  void EmplaceModule(const std::string& module_name, ModuleDump&& module_dump) {
+    modules_.emplace(std::piecewise_construct,
+                     std::forward_as_tuple(module_name),
+                     std::forward_as_tuple(module_dump.version, module_dump.base_addr, std::move(module_dump.dump), module_dump.sections));
+  }
 
-    if (Module32First(snapshot_handle, &me32)) {
-      do {
-        if (module_name.compare(me32.szModule) == 0) {
-          std::vector<uint8_t> dump;
-          dump.resize(me32.modBaseSize);
+  static std::vector<uint8_t> ReadFile(const std::string& file_path) {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error(std::format("oph/memory: file that cannot be opened: {}", file_path));
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
 
-          if (ReadProcessMemory(process_handle, me32.modBaseAddr, dump.data(), dump.size(), NULL)) {
-            modules_.emplace(std::piecewise_construct,
-                             std::forward_as_tuple(module_name),
-                             std::forward_as_tuple(GetFileVersion(me32.szExePath), (uint64_t)me32.modBaseAddr, std::move(dump)));
-          }
+  // Sections of a PE module dumped as-is, or nullopt if its headers are invalid or a section does
+  // not fit in `dump`.
+  static std::optional<std::vector<SectionLayout>> GetSectionLayouts(std::span<const uint8_t> dump) {
+    auto headers = ImageHeaders::Parse(dump);
+    if (!headers.has_value() || headers->format != ImageHeaders::kPE ||
+        std::ranges::any_of(headers->sections, [&](const SectionLayout& section) { return section.rva + section.size > dump.size(); })) {
+      return std::nullopt;
+    }
+    return std::move(headers->sections);
+  }
 
-          return;
-        }
-      } while (Module32Next(snapshot_handle, &me32));
+  // Copies the headers and the raw data of every PE section or loadable ELF segment in `file` to
+  // where they are mapped, at the image base the file expects. The version is left to the caller.
+  static std::optional<ModuleDump> MapImage(std::span<const uint8_t> file) {
+    auto headers = ImageHeaders::Parse(file);
+    if (!headers.has_value()) {
+      return std::nullopt;
+    }
+
+    std::vector<uint8_t> image(headers->image_size);
+    std::memcpy(image.data(), file.data(), std::min<uint64_t>({headers->headers_size, headers->image_size, file.size()}));
+    for (const auto& segment : headers->segments) {
+      if (segment.file_offset > file.size() || segment.filesz > file.size() - segment.file_offset) {
+        return std::nullopt;
+      }
+      std::memcpy(image.data() + segment.rva, file.data() + segment.file_offset, segment.filesz);
+    }
+    return ModuleDump{"", headers->image_base, std::move(image), std::move(headers->sections)};
+  }
+
+#ifdef _WIN32
+  static std::optional<ModuleDump> ReadModule(const HANDLE process_handle, const MODULEENTRY32& me32) {
+    std::vector<uint8_t> dump;
+    dump.resize(me32.modBaseSize);
+
+    if (!ReadProcessMemory(process_handle, me32.modBaseAddr, dump.data(), dump.size(), NULL)) {
+      return std::nullopt;
+    }
+    auto sections = GetSectionLayouts(dump);
+    if (!sections.has_value()) {
+      return std::nullopt;
     }
+    return ModuleDump{GetFileVersion(me32.szExePath), (uint64_t)me32.modBaseAddr, std::move(dump), std::move(sections.value())};
+  }
+
+  static std::unordered_map<std::string, MODULEENTRY32> GetModuleEntries(DWORD process_id) {
+    std::unordered_map<std::string, MODULEENTRY32> module_entries;
+
+    HANDLE snapshot_handle = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, process_id);
+    if (snapshot_handle != INVALID_HANDLE_VALUE) {
+      MODULEENTRY32 me32;
+      me32.dwSize = sizeof(MODULEENTRY32);
+
+      if (Module32First(snapshot_handle, &me32)) {
+        do {
+          module_entries.emplace(me32.szModule, me32);
+        } while (Module32Next(snapshot_handle, &me32));
+      }
+
+      CloseHandle(snapshot_handle);
+    }
+
+    return module_entries;
+  }
+
+  static std::unordered_map<std::string, DWORD> GetProcessIds() {
+    std::unordered_map<std::string, DWORD> process_ids;
+
+    HANDLE snapshot_handle = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot_handle != INVALID_HANDLE_VALUE) {
+      PROCESSENTRY32 pe32;
+      pe32.dwSize = sizeof(PROCESSENTRY32);
+
+      if (Process32First(snapshot_handle, &pe32)) {
+        do {
+          process_ids.emplace(pe32.szExeFile, pe32.th32ProcessID);
+        } while (Process32Next(snapshot_handle, &pe32));
+      }
+
+      CloseHandle(snapshot_handle);
+    }
+
+    return process_ids;
   }
 
   static DWORD GetProcessId(std::string_view process_name) {
@@ -221,12 +388,13 @@ class DumpStore {
   }
 
   static std::string GetFileVersion(std::string_view file_path);
+#endif  // _WIN32
 
   std::unordered_map<std::string, Module> modules_;
 };
 }  // namespace oph
 
-#ifdef UNICODE
+#if defined(_WIN32) && defined(UNICODE)
 #define Process32First Process32FirstW
 #define Process32Next Process32NextW
 #define PROCESSENTRY32 PROCESSENTRY32W
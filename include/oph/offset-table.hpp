@@ -0,0 +1,157 @@
+#pragma once
+
+// C++ standard
+#include <cstdint>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace oph {
+// Layout of the binary offset table written by BinaryFormatter. Everything is little-endian and
+// naturally aligned, so a loader can map the file and use it in place:
+//
+//   OffsetTableHeader
+//   OffsetTableEntry[num_entries]    in declaration order
+//   OffsetTableModule[num_modules]
+//   string pool                      names and versions, not terminated
+//   data                             values of byte entries
+constexpr uint32_t kOffsetTableMagic = 0x5448504F;  // "OPHT"
+constexpr uint16_t kOffsetTableVersion = 1;
+
+struct OffsetTableHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint32_t num_entries;
+  uint32_t num_modules;
+  uint64_t modules_offset;
+  uint64_t strings_offset;
+  uint64_t data_offset;
+};
+
+struct OffsetTableEntry {
+  enum Type : uint8_t {
+    kOffset,
+    kBytes,
+  };
+
+  enum Status : uint8_t {
+    kOk,
+    kError,
+    kTimeout,
+  };
+
+  // The offset itself, or for byte entries the position of the bytes in the data section.
+  uint64_t value;
+  uint64_t name_hash;
+  uint32_t name_offset;
+  uint16_t name_size;
+  uint16_t module_index;
+  uint32_t size;
+  Type type;
+  Status status;
+  uint16_t reserved;
+};
+
+struct OffsetTableModule {
+  uint32_t name_offset;
+  uint16_t name_size;
+  uint16_t version_size;
+  uint32_t version_offset;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(OffsetTableHeader) == 40);
+static_assert(sizeof(OffsetTableEntry) == 32);
+static_assert(sizeof(OffsetTableModule) == 16);
+
+// `module_index` of entries written before any module.
+constexpr uint16_t kNoModule = 0xFFFF;
+
+// 64-bit FNV-1a, usable at compile time to look entries up by a constant name.
+constexpr uint64_t HashName(std::string_view name) {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (char c : name) {
+    hash = (hash ^ (uint8_t)c) * 0x100000001B3;
+  }
+  return hash;
+}
+
+// Read-only view of a table, e.g. of a mapped file. Nothing is copied; the constructor only checks
+// that every section lies inside `data`.
+class OffsetTable {
+ public:
+  explicit OffsetTable(std::span<const uint8_t> data) : data_(data) {
+    if (data_.size() < sizeof(OffsetTableHeader)) {
+      throw std::runtime_error("oph/offset-table: truncated header");
+    }
+
+    header_ = reinterpret_cast<const OffsetTableHeader*>(data_.data());
+    if (header_->magic != kOffsetTableMagic || header_->version != kOffsetTableVersion || header_->entry_size != sizeof(OffsetTableEntry)) {
+      throw std::runtime_error(std::format("oph/offset-table: unsupported table: magic({:x}), version({})", header_->magic, header_->version));
+    }
+
+    // Offsets come from the file, so sizes are checked by subtracting them rather than adding to them.
+    uint64_t entries_end = sizeof(OffsetTableHeader) + (uint64_t)header_->num_entries * sizeof(OffsetTableEntry);
+    if (entries_end > header_->modules_offset || header_->modules_offset > header_->strings_offset ||
+        header_->strings_offset > header_->data_offset || header_->data_offset > data_.size() ||
+        header_->num_modules > (header_->strings_offset - header_->modules_offset) / sizeof(OffsetTableModule) ||
+        header_->modules_offset % alignof(OffsetTableModule) != 0) {
+      throw std::runtime_error("oph/offset-table: corrupted section layout");
+    }
+
+    entries_ = {reinterpret_cast<const OffsetTableEntry*>(data_.data() + sizeof(OffsetTableHeader)), header_->num_entries};
+    modules_ = {reinterpret_cast<const OffsetTableModule*>(data_.data() + header_->modules_offset), header_->num_modules};
+  }
+
+  std::span<const OffsetTableEntry> GetEntries() const { return entries_; }
+
+  std::span<const OffsetTableModule> GetModules() const { return modules_; }
+
+  std::string_view GetName(const OffsetTableEntry& entry) const {
+    return GetString(entry.name_offset, entry.name_size);
+  }
+
+  std::string_view GetName(const OffsetTableModule& module) const {
+    return GetString(module.name_offset, module.name_size);
+  }
+
+  std::string_view GetVersion(const OffsetTableModule& module) const {
+    return GetString(module.version_offset, module.version_size);
+  }
+
+  std::span<const uint8_t> GetBytes(const OffsetTableEntry& entry) const {
+    uint64_t data_size = data_.size() - header_->data_offset;
+    if (entry.type != OffsetTableEntry::kBytes || entry.value > data_size || entry.size > data_size - entry.value) {
+      return {};
+    }
+    return data_.subspan(header_->data_offset + entry.value, entry.size);
+  }
+
+  // First entry called `name`, or nullptr.
+  const OffsetTableEntry* Find(std::string_view name) const {
+    uint64_t hash = HashName(name);
+    for (const auto& entry : entries_) {
+      if (entry.name_hash == hash && GetName(entry) == name) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  std::string_view GetString(uint32_t offset, uint32_t size) const {
+    uint64_t strings_size = header_->data_offset - header_->strings_offset;
+    if (offset > strings_size || size > strings_size - offset) {
+      return {};
+    }
+    return {reinterpret_cast<const char*>(data_.data() + header_->strings_offset + offset), size};
+  }
+
+  std::span<const uint8_t> data_;
+  const OffsetTableHeader* header_;
+  std::span<const OffsetTableEntry> entries_;
+  std::span<const OffsetTableModule> modules_;
+};
+}  // namespace oph
@@ -1,155 +1,855 @@
 #pragma once
 
 // C++ standard
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <concepts>
 #include <condition_variable>
+#include <deque>
+#include <format>
 #include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <ostream>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // This project
+#include "async.hpp"
+#include "cancellation.hpp"
 #include "formatter.hpp"
 #include "memory.hpp"
+#include "scan-profile.hpp"
+#include "scan-stats.hpp"
+#include "sig-scan.hpp"
+#include "sigexpr.hpp"
 #include "thread-pool.hpp"
 
 namespace oph {
+// A scan function takes the dump store and `Args`, optionally followed by a std::stop_token that is
+// triggered once the scan has timed out, and returns `Result`.
+template <typename ScanFunc, typename Result, typename... Args>
+concept ScanFunction =
+    (std::is_invocable_v<ScanFunc, const DumpStore&, Args..., std::stop_token> &&
+     std::is_same_v<std::invoke_result_t<ScanFunc, const DumpStore&, Args..., std::stop_token>, Result>) ||
+    (std::is_invocable_v<ScanFunc, const DumpStore&, Args...> && std::is_same_v<std::invoke_result_t<ScanFunc, const DumpStore&, Args...>, Result>);
+
+// Calls a ScanFunction, passing `stoken` only if it takes one.
+template <typename ScanFunc, typename... Args>
+decltype(auto) InvokeScan(ScanFunc& scan_func, std::stop_token stoken, const DumpStore& store, Args&&... args) {
+  if constexpr (std::is_invocable_v<ScanFunc&, const DumpStore&, Args..., std::stop_token>) {
+    return std::invoke(scan_func, store, std::forward<Args>(args)..., std::move(stoken));
+  } else {
+    return std::invoke(scan_func, store, std::forward<Args>(args)...);
+  }
+}
+
 class Patcher {
  public:
+  using Clock = std::chrono::steady_clock;
+
   enum LangType {
     kCpp,
+    kJson,
+    kBinary,
   };
 
-  Patcher(LangType format_type) : formatter_(NewFormatter(format_type)) {
+  Patcher(LangType format_type) : lang_type_(format_type) {
   }
 
-  Patcher(LangType format_type, size_t num_threads)
-      : formatter_(NewFormatter(format_type)), scan_pool_(num_threads) {
+  Patcher(LangType format_type, size_t num_threads, ThreadPool::ScheduleType schedule_type = ThreadPool::kSharedQueue)
+      : lang_type_(format_type), scan_pool_(num_threads, schedule_type) {
   }
 
+  // Scans still running, e.g. past their deadline, are asked to stop, and the pool finishes them
+  // before anything they use is destroyed.
   ~Patcher() {
-    delete formatter_;
+    stop_source_.request_stop();
+    for (auto& result : scan_results_) {
+      result.stop_source.request_stop();
+    }
+    for (auto& result : named_results_) {
+      result.stop_source.request_stop();
+    }
   }
 
+#ifdef _WIN32
   void AddModule(const std::string& process_name, const std::vector<std::string>& module_names = {}) {
-    dump_store_.DumpModule(process_name, module_names);
+    dump_store_.DumpModule(scan_pool_, process_name, module_names);
+  }
+
+  void AddModule(const std::vector<std::pair<std::string, std::vector<std::string>>>& targets) {
+    dump_store_.DumpModule(scan_pool_, targets);
+  }
+#endif  // _WIN32
+
+  // Loads a PE or ELF file instead of dumping a running process, see DumpStore::LoadModule. Like
+  // AddModule, it must come before the scans that read the module.
+  void LoadModule(const std::string& module_name, const std::string& file_path, const std::string& version) {
+    dump_store_.LoadModule(module_name, file_path, version);
+  }
+
+  // Scans added after this call are reported as TIMEOUT if they have not finished `timeout` after
+  // they started, and their stop token is triggered. Zero, the default, disables the limit.
+  Patcher& SetScanTimeout(Clock::duration timeout) {
+    scan_timeout_ = timeout;
+    return *this;
+  }
+
+  // Export reports every scan that has not finished `timeout` after it was called as TIMEOUT
+  // instead of waiting for it. Zero, the default, disables the limit.
+  Patcher& SetExportTimeout(Clock::duration timeout) {
+    export_timeout_ = timeout;
+    return *this;
   }
 
   Patcher& WriteLineBreak() {
-    formatter_->WriteLineBreak();
+    template_.push_back({TemplateItem::kLineBreak});
     return *this;
   }
 
   Patcher& WriteModule(const std::string& name) {
     if (dump_store_.Contains(name)) {
-      formatter_->WriteModule(name, dump_store_.GetModule(name).GetVersion());
+      template_.push_back({TemplateItem::kModule, name, dump_store_.GetModule(name).GetVersion()});
     } else {
-      formatter_->WriteModule(name, "ERROR");
+      template_.push_back({TemplateItem::kModule, name, "ERROR"});
     }
     return *this;
   }
 
   Patcher& WriteComment(std::string_view comment) {
-    formatter_->WriteComment(comment);
+    template_.push_back({TemplateItem::kComment, std::string(comment)});
     return *this;
   }
 
   template <typename ScanFunc>
-    requires std::is_invocable_v<ScanFunc, const DumpStore&> && std::is_same_v<std::invoke_result_t<ScanFunc, const DumpStore&>, uint64_t>
+    requires ScanFunction<ScanFunc, uint64_t> && (!std::is_same_v<std::decay_t<ScanFunc>, SigScan>)
   Patcher& WriteOffset(std::string_view name, ScanFunc&& scan_func) {
-    formatter_->WriteOffset(name);
+    template_.push_back({TemplateItem::kOffset, std::string(name)});
 
-    size_t scan_index = scan_results_.size();
-    scan_results_.resize(scan_index + 1);
+    scan_pool_.EnqueueDetach(&Patcher::ScanOffset<std::decay_t<ScanFunc>>, this, AddScanResult(name, true), std::forward<ScanFunc>(scan_func));
 
-    scan_wg_.Add();
-    scan_pool_.EnqueueDetach(&Patcher::ScanOffset, this, scan_index, std::forward<ScanFunc>(scan_func));
+    return *this;
+  }
+
+  // Same as above, but `scan_func` also receives the values of the named scans in `deps`, in order.
+  // It only runs once all of them have finished, and is reported as an error (or as TIMEOUT) if any
+  // of them failed (or timed out).
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, uint64_t, std::span<const uint64_t>>
+  Patcher& WriteOffset(std::string_view name, std::initializer_list<std::string_view> deps, ScanFunc&& scan_func) {
+    auto dep_nodes = FindScanNodes(deps);
+    template_.push_back({TemplateItem::kOffset, std::string(name)});
+
+    AddScanNode(AddScanResult(name, true), std::move(dep_nodes),
+                [this, _scan_func = std::forward<ScanFunc>(scan_func)](std::span<const uint64_t> values, std::stop_token stoken) mutable {
+                  return ScanValue{InvokeScan(_scan_func, stoken, dump_store_, values)};
+                });
 
     return *this;
   }
 
   template <typename ScanFunc>
-    requires std::is_invocable_v<ScanFunc, const DumpStore&> && std::is_same_v<std::invoke_result_t<ScanFunc, const DumpStore&>, std::vector<uint8_t>>
+    requires ScanFunction<ScanFunc, std::vector<uint8_t>>
   Patcher& WriteBytes(std::string_view name, ScanFunc&& scan_func) {
-    formatter_->WriteBytes(name);
+    template_.push_back({TemplateItem::kBytes, std::string(name)});
 
-    size_t scan_index = scan_results_.size();
-    scan_results_.resize(scan_index + 1);
+    scan_pool_.EnqueueDetach(&Patcher::ScanBytes<std::decay_t<ScanFunc>>, this, AddScanResult(name, true, true), std::forward<ScanFunc>(scan_func));
 
-    scan_wg_.Add();
-    scan_pool_.EnqueueDetach(&Patcher::ScanBytes, this, scan_index, std::forward<ScanFunc>(scan_func));
+    return *this;
+  }
+
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, std::vector<uint8_t>, std::span<const uint64_t>>
+  Patcher& WriteBytes(std::string_view name, std::initializer_list<std::string_view> deps, ScanFunc&& scan_func) {
+    auto dep_nodes = FindScanNodes(deps);
+    template_.push_back({TemplateItem::kBytes, std::string(name)});
+
+    AddScanNode(AddScanResult(name, true, true), std::move(dep_nodes),
+                [this, _scan_func = std::forward<ScanFunc>(scan_func)](std::span<const uint64_t> values, std::stop_token stoken) mutable {
+                  return ScanValue{0, InvokeScan(_scan_func, stoken, dump_store_, values)};
+                });
+
+    return *this;
+  }
+
+  // Registers a named intermediate result, e.g. the hit of one signature in one section, that any
+  // number of later WriteOffset/WriteBytes/DefineScan calls can list as a dependency. It is computed
+  // once, on the pool, and its value is shared by every scan that depends on it.
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, uint64_t> && (!std::is_same_v<std::decay_t<ScanFunc>, SigScan>)
+  Patcher& DefineScan(std::string_view name, ScanFunc&& scan_func) {
+    return DefineScan(name, {}, [_scan_func = std::forward<ScanFunc>(scan_func)](const DumpStore& store, std::span<const uint64_t>, std::stop_token stoken) mutable {
+      return InvokeScan(_scan_func, stoken, store);
+    });
+  }
+
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, uint64_t, std::span<const uint64_t>>
+  Patcher& DefineScan(std::string_view name, std::initializer_list<std::string_view> deps, ScanFunc&& scan_func) {
+    if (named_scans_.contains(std::string(name))) {
+      throw std::runtime_error(std::format("oph/patcher: scan that already exists: {}", name));
+    }
+
+    auto node = AddScanNode(AddScanResult(name, false), FindScanNodes(deps),
+                            [this, _scan_func = std::forward<ScanFunc>(scan_func)](std::span<const uint64_t> values, std::stop_token stoken) mutable {
+                              return ScanValue{InvokeScan(_scan_func, stoken, dump_store_, values)};
+                            });
+    named_scans_.emplace(name, node);
+
+    return *this;
+  }
+
+  // Coroutine scan functions can `co_await` sub-scans, `GetScanPool().WhenAll(...)` batches and
+  // futures without holding a pool worker while they wait.
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, Async<uint64_t>>
+  Patcher& WriteOffset(std::string_view name, ScanFunc&& scan_func) {
+    template_.push_back({TemplateItem::kOffset, std::string(name)});
+
+    scan_pool_.Spawn(ScanOffsetAsync(AddScanResult(name, true), std::forward<ScanFunc>(scan_func)));
+
+    return *this;
+  }
 
+  template <typename ScanFunc>
+    requires ScanFunction<ScanFunc, Async<std::vector<uint8_t>>>
+  Patcher& WriteBytes(std::string_view name, ScanFunc&& scan_func) {
+    template_.push_back({TemplateItem::kBytes, std::string(name)});
+
+    scan_pool_.Spawn(ScanBytesAsync(AddScanResult(name, true, true), std::forward<ScanFunc>(scan_func)));
+
+    return *this;
+  }
+
+  // SigScans are not run right away. Export groups them by module and section and searches each
+  // section once for all of its signatures, so the cost grows with the number of distinct sections
+  // rather than the number of offsets.
+  Patcher& WriteOffset(std::string_view name, const SigScan& scan) {
+    template_.push_back({TemplateItem::kOffset, std::string(name)});
+    PlanSigScan(AddScanResult(name, true), scan);
+    return *this;
+  }
+
+  Patcher& DefineScan(std::string_view name, const SigScan& scan) {
+    if (named_scans_.contains(std::string(name))) {
+      throw std::runtime_error(std::format("oph/patcher: scan that already exists: {}", name));
+    }
+
+    named_scans_.emplace(name, PlanSigScan(AddScanResult(name, false), scan));
     return *this;
   }
 
+  ThreadPool& GetScanPool() { return scan_pool_; }
+
   void Export(std::ostream& os) {
-    scan_wg_.Wait();
-    formatter_->Export(os, scan_results_);
+    Export(os, lang_type_);
   }
 
   void Export(const std::string& file_path) {
+    Export(file_path, lang_type_);
+  }
+
+  // Writes the output in declaration order as the results come in, so whoever reads `os` can start
+  // on the first offsets while later scans are still running. `os` is flushed whenever the next
+  // result is not ready yet. The results are kept, so calling this again, e.g. in another
+  // `lang_type`, writes the same results without scanning again.
+  void Export(std::ostream& os, LangType lang_type) {
+    RunSigScans();
+
+    auto formatter = NewFormatter(lang_type);
+    auto export_deadline = export_timeout_ > Clock::duration::zero() ? Clock::now() + export_timeout_ : Clock::time_point::max();
+    formatter->ExportBegin(os);
+    for (size_t i = 0; i < scan_results_.size(); i++) {
+      const auto& result = scan_results_[i];
+      if (!result.Finished()) {
+        os.flush();
+        WaitScans(export_deadline, [&] { return result.Finished(); });
+      }
+      formatter->ExportSlot(os, i, GetSlotValue(result));
+    }
+    formatter->ExportEnd(os);
+    os.flush();
+
+    WaitScans(export_deadline, [&] { return scan_wg_.Count() == 0; });
+  }
+
+  void Export(const std::string& file_path, LangType lang_type) {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+      Export(file, lang_type);
+    }
+  }
+
+  // Timings and work of every scan, named ones included, in the order they were added. Only
+  // meaningful after Export.
+  std::vector<ScanProfile> GetScanProfiles() const {
+    std::vector<ScanProfile> profiles;
+    profiles.reserve(scan_results_.size() + named_results_.size());
+    auto add_profile = [&](const ScanResult& result) {
+      auto& profile = profiles.emplace_back();
+      profile.name = result.name;
+      profile.queued_at = result.queued_at.load(std::memory_order_acquire);
+      profile.started_at = result.started_at.load(std::memory_order_acquire);
+
+      switch (result.status.load(std::memory_order_acquire)) {
+        case ScanResult::kDone:
+          profile.status = "OK";
+          break;
+        case ScanResult::kFailed:
+          profile.status = "ERROR";
+          break;
+        case ScanResult::kTimedOut:
+          profile.status = "TIMEOUT";
+          break;
+        default:
+          profile.status = "PENDING";
+          profile.started_at = Clock::time_point();
+          profile.finished_at = profile.queued_at;
+          return;
+      }
+      profile.worker = result.worker;
+      profile.finished_at = result.finished_at;
+      profile.stats = result.stats;
+    };
+    std::ranges::for_each(scan_results_, add_profile);
+    std::ranges::for_each(named_results_, add_profile);
+    return profiles;
+  }
+
+  // Writes GetScanProfiles() as a table sorted by wall time, slowest first.
+  void ExportProfileReport(std::ostream& os) const {
+    WriteProfileReport(os, GetScanProfiles());
+  }
+
+  void ExportProfileReport(const std::string& file_path) const {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+      ExportProfileReport(file);
+    }
+  }
+
+  // Writes GetScanProfiles() in the Chrome trace event format.
+  void ExportProfileTrace(std::ostream& os) const {
+    WriteProfileTrace(os, GetScanProfiles());
+  }
+
+  void ExportProfileTrace(const std::string& file_path) const {
     std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
     if (file.is_open()) {
-      Export(file);
+      ExportProfileTrace(file);
     }
   }
 
  private:
+  // Counts the unfinished scans. Every Done wakes the waiters, which can wait for any condition
+  // that becomes true when a scan finishes, not only for the count to reach zero.
   class WaitGroup {
    public:
     void Add() {
-      counter_++;
+      counter_.fetch_add(1);
     }
 
     void Done() {
-      counter_--;
+      std::lock_guard<std::mutex> lock(mutex_);
+      counter_.fetch_sub(1);
       cv_.notify_all();
     }
 
-    void Wait() {
+    int32_t Count() const {
+      return counter_.load();
+    }
+
+    template <typename Pred>
+    void Wait(Pred&& pred) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, std::forward<Pred>(pred));
+    }
+
+    // Returns false if `deadline` passed first.
+    template <typename Pred>
+    bool WaitUntil(Clock::time_point deadline, Pred&& pred) {
       std::unique_lock<std::mutex> lock(mutex_);
-      cv_.wait(lock, [&] { return counter_ <= 0; });
+      return cv_.wait_until(lock, deadline, std::forward<Pred>(pred));
     }
 
    private:
-    std::atomic_int32_t counter_;
+    std::atomic_int32_t counter_ = 0;
     std::mutex mutex_;
     std::condition_variable cv_;
   };
 
-  void ScanOffset(size_t scan_index, std::function<uint64_t(const DumpStore&)>&& scan_func) {
+  // What a scan found. Offset scans and named scans only use `offset`.
+  struct ScanValue {
+    uint64_t offset;
+    std::vector<uint8_t> bytes;
+  };
+
+  // Outcome of one scan. It leaves kPending exactly once, either when the scan finishes or when
+  // WaitScans gives up on it, and whichever comes second is ignored.
+  struct ScanResult {
+    enum Status : uint32_t {
+      kPending,
+      kCommitting,
+      kDone,
+      kFailed,
+      kTimedOut,
+    };
+
+    bool Finished() const {
+      uint32_t current = status.load(std::memory_order_acquire);
+      return current != kPending && current != kCommitting;
+    }
+
+    std::atomic_uint32_t status = kPending;
+    std::atomic<Clock::time_point> queued_at = Clock::time_point();
+    std::atomic<Clock::time_point> started_at = Clock::time_point();
+    Clock::duration timeout = Clock::duration::zero();
+    std::stop_source stop_source;
+    std::string name;
+
+    bool is_bytes = false;
+
+    // Written by whoever moves the status out of kPending.
+    ScanValue value;
+    Clock::time_point finished_at;
+    std::optional<size_t> worker;
+    ScanStats stats;
+  };
+
+  // How often WaitScans looks for timed scans that have started since it last checked.
+  static constexpr Clock::duration kWatchInterval = std::chrono::milliseconds(10);
+
+  // One vertex of the scan graph. `num_waiting` counts the unfinished dependencies plus one guard
+  // held while the node is being wired up; whoever drops it to zero schedules the node.
+  struct ScanNode {
+    std::vector<ScanNode*> deps;
+    std::vector<ScanNode*> dependents;
+    std::atomic_size_t num_waiting = 1;
+    bool done = false;
+    bool failed = false;
+    uint64_t value = 0;
+    ScanResult* result = nullptr;
+    std::function<ScanValue(std::span<const uint64_t>, std::stop_token)> scan_func;
+  };
+
+  // One call on the formatter, recorded so that every Export can replay it on a formatter of its own.
+  struct TemplateItem {
+    enum Type {
+      kLineBreak,
+      kComment,
+      kModule,
+      kOffset,
+      kBytes,
+    };
+
+    Type type;
+    std::string text;
+    std::string version;
+  };
+
+  // Exported results are the template arguments, in order; the others belong to named scans.
+  ScanResult* AddScanResult(std::string_view name, bool exported, bool is_bytes = false) {
+    auto& result = exported ? scan_results_.emplace_back() : named_results_.emplace_back();
+    result.name = name;
+    result.is_bytes = is_bytes;
+    result.timeout = scan_timeout_;
+    has_timed_scans_ |= scan_timeout_ > Clock::duration::zero();
+    result.queued_at.store(Clock::now(), std::memory_order_relaxed);
+    scan_wg_.Add();
+    return &result;
+  }
+
+  // Returns false if the scan has already been finished, e.g. given up on, and need not start.
+  static bool StartScan(ScanResult* result) {
+    if (result->status.load(std::memory_order_acquire) != ScanResult::kPending) {
+      return false;
+    }
+    result->started_at.store(Clock::now(), std::memory_order_release);
+    return true;
+  }
+
+  void FinishScan(ScanResult* result, ScanResult::Status status, ScanValue&& value = {}, const ScanStats& stats = {}) {
+    uint32_t expected = ScanResult::kPending;
+    if (result->status.compare_exchange_strong(expected, ScanResult::kCommitting, std::memory_order_acq_rel)) {
+      result->value = std::move(value);
+      result->finished_at = Clock::now();
+      result->worker = scan_pool_.GetWorkerIndex();
+      result->stats = stats;
+      result->status.store(status, std::memory_order_release);
+      scan_wg_.Done();
+    }
+  }
+
+  void TimeOutScan(ScanResult* result) {
+    uint32_t expected = ScanResult::kPending;
+    if (result->status.compare_exchange_strong(expected, ScanResult::kCommitting, std::memory_order_acq_rel)) {
+      result->finished_at = Clock::now();
+      result->status.store(ScanResult::kTimedOut, std::memory_order_release);
+      result->stop_source.request_stop();
+      scan_wg_.Done();
+    }
+  }
+
+  // Runs `make_value` as the scan of `result`. Cancelled, which the searches throw once the scan's
+  // stop token is triggered, is reported as TIMEOUT, anything else as an error.
+  template <typename MakeValue>
+  void RunScan(ScanResult* result, MakeValue&& make_value) {
+    if (!StartScan(result)) {
+      return;
+    }
+
+    ScanStats stats;
+    try {
+      ScanValue value;
+      {
+        ScanStatsScope stats_scope(stats);
+        value = make_value(result->stop_source.get_token());
+      }
+      FinishScan(result, ScanResult::kDone, std::move(value), stats);
+    } catch (const Cancelled&) {
+      FinishScan(result, ScanResult::kTimedOut, {}, stats);
+    } catch (...) {
+      FinishScan(result, ScanResult::kFailed, {}, stats);
+    }
+  }
+
+  template <typename ScanFunc>
+  void ScanOffset(ScanResult* result, ScanFunc scan_func) {
+    RunScan(result, [&](std::stop_token stoken) { return ScanValue{InvokeScan(scan_func, stoken, dump_store_)}; });
+  }
+
+  template <typename ScanFunc>
+  void ScanBytes(ScanResult* result, ScanFunc scan_func) {
+    RunScan(result, [&](std::stop_token stoken) { return ScanValue{0, InvokeScan(scan_func, stoken, dump_store_)}; });
+  }
+
+  template <typename ScanFunc>
+  Async<void> ScanOffsetAsync(ScanResult* result, ScanFunc scan_func) {
+    if (!StartScan(result)) {
+      co_return;
+    }
+
     try {
-      scan_results_[scan_index] = formatter_->MakeOffset(scan_func(dump_store_));
+      FinishScan(result, ScanResult::kDone, ScanValue{co_await InvokeScan(scan_func, result->stop_source.get_token(), dump_store_)});
+    } catch (const Cancelled&) {
+      FinishScan(result, ScanResult::kTimedOut);
     } catch (...) {
-      scan_results_[scan_index] = "ERROR";
+      FinishScan(result, ScanResult::kFailed);
     }
-    scan_wg_.Done();
   }
 
-  void ScanBytes(size_t scan_index, std::function<std::vector<uint8_t>(const DumpStore&)>&& scan_func) {
+  template <typename ScanFunc>
+  Async<void> ScanBytesAsync(ScanResult* result, ScanFunc scan_func) {
+    if (!StartScan(result)) {
+      co_return;
+    }
+
     try {
-      scan_results_[scan_index] = formatter_->MakeBytes(scan_func(dump_store_));
+      FinishScan(result, ScanResult::kDone, ScanValue{0, co_await InvokeScan(scan_func, result->stop_source.get_token(), dump_store_)});
+    } catch (const Cancelled&) {
+      FinishScan(result, ScanResult::kTimedOut);
     } catch (...) {
-      scan_results_[scan_index] = "ERROR";
+      FinishScan(result, ScanResult::kFailed);
+    }
+  }
+
+  // Waits for `done`, which must become true as scans finish, giving up on every scan past its own
+  // or the export deadline meanwhile. Starts are not signalled, so while a timed scan has not
+  // started yet this wakes up every `kWatchInterval`.
+  template <typename Pred>
+  void WaitScans(Clock::time_point export_deadline, Pred&& done) {
+    for (;;) {
+      auto now = Clock::now();
+      if (now >= export_deadline) {
+        stop_source_.request_stop();
+        for (auto& result : scan_results_) {
+          TimeOutScan(&result);
+        }
+        for (auto& result : named_results_) {
+          TimeOutScan(&result);
+        }
+
+        // Only scans that are committing right now are left.
+        scan_wg_.Wait(done);
+        return;
+      }
+
+      auto wake_at = export_deadline;
+      auto watch = [&](ScanResult& result) {
+        if (result.timeout == Clock::duration::zero() || result.status.load(std::memory_order_acquire) != ScanResult::kPending) {
+          return;
+        }
+
+        auto started_at = result.started_at.load(std::memory_order_acquire);
+        if (started_at == Clock::time_point()) {
+          wake_at = std::min(wake_at, now + kWatchInterval);
+        } else if (now >= started_at + result.timeout) {
+          TimeOutScan(&result);
+        } else {
+          wake_at = std::min(wake_at, started_at + result.timeout);
+        }
+      };
+      if (has_timed_scans_) {
+        std::ranges::for_each(scan_results_, watch);
+        std::ranges::for_each(named_results_, watch);
+      }
+
+      if (wake_at == Clock::time_point::max()) {
+        scan_wg_.Wait(done);
+        return;
+      }
+      if (scan_wg_.WaitUntil(wake_at, done)) {
+        return;
+      }
     }
-    scan_wg_.Done();
   }
 
-  static Formatter* NewFormatter(LangType lang_type) {
+  std::vector<ScanNode*> FindScanNodes(std::initializer_list<std::string_view> names) const {
+    std::vector<ScanNode*> nodes;
+    nodes.reserve(names.size());
+    for (auto name : names) {
+      auto iter = named_scans_.find(std::string(name));
+      if (iter == named_scans_.end()) {
+        throw std::runtime_error(std::format("oph/patcher: scan that does not exist: {}", name));
+      }
+      nodes.push_back(iter->second);
+    }
+    return nodes;
+  }
+
+  template <typename ScanFunc>
+  ScanNode* AddScanNode(ScanResult* result, std::vector<ScanNode*>&& deps, ScanFunc&& scan_func) {
+    auto& node = scan_nodes_.emplace_back();
+    node.deps = std::move(deps);
+    node.result = result;
+    node.scan_func = std::forward<ScanFunc>(scan_func);
+
+    {
+      std::lock_guard<std::mutex> lock(scan_graph_mutex_);
+      for (auto dep : node.deps) {
+        if (!dep->done) {
+          dep->dependents.push_back(&node);
+          node.num_waiting++;
+        }
+      }
+    }
+    ReleaseScanNode(&node);
+
+    return &node;
+  }
+
+  void ReleaseScanNode(ScanNode* node) {
+    if (node->num_waiting.fetch_sub(1) == 1) {
+      node->result->queued_at.store(Clock::now(), std::memory_order_release);
+      scan_pool_.EnqueueDetach(&Patcher::RunScanNode, this, node);
+    }
+  }
+
+  struct PlannedScan {
+    ScanNode* node;
+    SigScan scan;
+  };
+
+  // A planned node keeps its registration guard until RunSigScanGroup completes it directly.
+  ScanNode* PlanSigScan(ScanResult* result, const SigScan& scan) {
+    auto& node = scan_nodes_.emplace_back();
+    node.result = result;
+
+    planned_scans_[{scan.GetModuleName(), scan.GetSectionName()}].push_back({&node, scan});
+
+    return &node;
+  }
+
+  void RunSigScans() {
+    for (auto& [section_key, scans] : planned_scans_) {
+      for (const auto& planned : scans) {
+        planned.node->result->queued_at.store(Clock::now(), std::memory_order_release);
+      }
+      scan_pool_.EnqueueDetach(&Patcher::RunSigScanGroup, this, section_key.first, section_key.second, std::move(scans));
+    }
+    planned_scans_.clear();
+  }
+
+  // The pass is shared, so it is only cut short once every scan of the group has been given up on
+  // or the export deadline has passed.
+  void RunSigScanGroup(const std::string& module_name, const std::string& section_name, std::vector<PlannedScan>&& scans) {
+    bool started = false;
+    for (const auto& planned : scans) {
+      started |= StartScan(planned.node->result);
+    }
+
+    // Every scan of the group is charged with the whole shared pass.
+    ScanStats stats;
+    const Section* section = nullptr;
+    ScanResult::Status group_status = ScanResult::kDone;
+    std::vector<std::vector<uint64_t>> matches;
+    try {
+      if (!started) {
+        throw Cancelled();
+      }
+      section = &dump_store_.GetSection(module_name, section_name);
+
+      std::vector<const SigExpr*> sigs;
+      sigs.reserve(scans.size());
+      for (const auto& planned : scans) {
+        sigs.push_back(&planned.scan.GetSig());
+      }
+      SigSet sig_set(std::move(sigs));
+
+      matches = sig_set.Search(scan_pool_, section->GetDump(), stop_source_.get_token(), stats, [&] {
+        if (std::ranges::none_of(scans, [](const PlannedScan& planned) {
+              return planned.node->result->status.load(std::memory_order_relaxed) == ScanResult::kPending;
+            })) {
+          throw Cancelled();
+        }
+      });
+    } catch (const Cancelled&) {
+      section = nullptr;
+      group_status = ScanResult::kTimedOut;
+    } catch (...) {
+      section = nullptr;
+      group_status = ScanResult::kFailed;
+    }
+
+    for (size_t i = 0; i < scans.size(); i++) {
+      ScanNode* node = scans[i].node;
+      if (section == nullptr) {
+        FinishScan(node->result, group_status, {}, stats);
+      } else {
+        try {
+          node->value = scans[i].scan.Resolve(*section, matches[i]);
+          FinishScan(node->result, ScanResult::kDone, ScanValue{node->value}, stats);
+        } catch (...) {
+          FinishScan(node->result, ScanResult::kFailed, {}, stats);
+        }
+      }
+      CompleteScanNode(node);
+    }
+  }
+
+  void RunScanNode(ScanNode* node) {
+    std::vector<uint64_t> values;
+    values.reserve(node->deps.size());
+    for (auto dep : node->deps) {
+      if (dep->failed) {
+        // A dependency can still be committing its timeout, so anything but kFailed means it timed out.
+        if (dep->result->status.load(std::memory_order_acquire) == ScanResult::kFailed) {
+          FinishScan(node->result, ScanResult::kFailed);
+        } else {
+          FinishScan(node->result, ScanResult::kTimedOut);
+        }
+        break;
+      }
+      values.push_back(dep->value);
+    }
+
+    if (values.size() == node->deps.size()) {
+      RunScan(node->result, [&](std::stop_token stoken) {
+        auto value = node->scan_func(values, stoken);
+        node->value = value.offset;
+        return value;
+      });
+    }
+    node->scan_func = nullptr;
+    CompleteScanNode(node);
+  }
+
+  // A node only counts as succeeded if its own result was kept, so the dependents of a scan that
+  // timed out see it as timed out even if it finished later.
+  void CompleteScanNode(ScanNode* node) {
+    node->failed = node->result->status.load(std::memory_order_acquire) != ScanResult::kDone;
+
+    std::vector<ScanNode*> dependents;
+    {
+      std::lock_guard<std::mutex> lock(scan_graph_mutex_);
+      node->done = true;
+      dependents.swap(node->dependents);
+    }
+    for (auto dependent : dependents) {
+      ReleaseScanNode(dependent);
+    }
+  }
+
+  static SlotValue GetSlotValue(const ScanResult& result) {
+    SlotValue value;
+    switch (result.status.load(std::memory_order_acquire)) {
+      case ScanResult::kDone:
+        value.status = SlotValue::kOk;
+        break;
+      case ScanResult::kTimedOut:
+        value.status = SlotValue::kTimeout;
+        break;
+      default:
+        value.status = SlotValue::kError;
+        break;
+    }
+    value.is_bytes = result.is_bytes;
+    value.offset = result.value.offset;
+    value.bytes = result.value.bytes;
+    return value;
+  }
+
+  std::unique_ptr<Formatter> NewFormatter(LangType lang_type) const {
+    std::unique_ptr<Formatter> formatter;
     switch (lang_type) {
-      case oph::Patcher::kCpp:
-        return new CppFormatter();
+      case oph::Patcher::kJson:
+        formatter = std::make_unique<JsonFormatter>();
+        break;
+      case oph::Patcher::kBinary:
+        formatter = std::make_unique<BinaryFormatter>();
+        break;
       default:
-        return new CppFormatter();
+        formatter = std::make_unique<CppFormatter>();
+        break;
+    }
+
+    for (const auto& item : template_) {
+      switch (item.type) {
+        case TemplateItem::kLineBreak:
+          formatter->WriteLineBreak();
+          break;
+        case TemplateItem::kComment:
+          formatter->WriteComment(item.text);
+          break;
+        case TemplateItem::kModule:
+          formatter->WriteModule(item.text, item.version);
+          break;
+        case TemplateItem::kOffset:
+          formatter->WriteOffset(item.text);
+          break;
+        case TemplateItem::kBytes:
+          formatter->WriteBytes(item.text);
+          break;
+      }
     }
+    return formatter;
   }
 
   DumpStore dump_store_;
-  Formatter* formatter_;
-  std::vector<std::string> scan_results_;
+  LangType lang_type_;
+  std::vector<TemplateItem> template_;
+  std::deque<ScanResult> scan_results_;
+  std::deque<ScanResult> named_results_;
+  std::deque<ScanNode> scan_nodes_;
+  std::unordered_map<std::string, ScanNode*> named_scans_;
+  std::map<std::pair<std::string, std::string>, std::vector<PlannedScan>> planned_scans_;
+  std::mutex scan_graph_mutex_;
+  Clock::duration scan_timeout_ = Clock::duration::zero();
+  Clock::duration export_timeout_ = Clock::duration::zero();
+  bool has_timed_scans_ = false;
+  std::stop_source stop_source_;
   WaitGroup scan_wg_;
   ThreadPool scan_pool_;
 };
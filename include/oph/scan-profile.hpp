@@ -0,0 +1,118 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Other library
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+// This project
+#include "json.hpp"
+#include "scan-stats.hpp"
+
+namespace oph {
+// Where the time of one scan went. `started_at` is left at the clock's epoch for a scan that was
+// given up on before it started, and `worker` is empty if it did not finish on a pool worker.
+struct ScanProfile {
+  using Clock = std::chrono::steady_clock;
+
+  std::string name;
+  std::string_view status;
+  std::optional<size_t> worker;
+  Clock::time_point queued_at;
+  Clock::time_point started_at;
+  Clock::time_point finished_at;
+  ScanStats stats;
+
+  bool Started() const { return started_at != Clock::time_point(); }
+
+  Clock::duration QueueWait() const { return Started() ? started_at - queued_at : finished_at - queued_at; }
+
+  Clock::duration WallTime() const { return Started() ? finished_at - started_at : Clock::duration::zero(); }
+};
+
+// Plain text table of the scans, slowest first.
+inline void WriteProfileReport(std::ostream& os, std::span<const ScanProfile> profiles) {
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  std::vector<const ScanProfile*> sorted;
+  sorted.reserve(profiles.size());
+  for (const auto& profile : profiles) {
+    sorted.push_back(&profile);
+  }
+  std::ranges::stable_sort(sorted, std::ranges::greater(), [](const ScanProfile* profile) { return profile->WallTime(); });
+
+  ScanProfile::Clock::duration total_wall = ScanProfile::Clock::duration::zero();
+  for (const auto& profile : profiles) {
+    total_wall += profile.WallTime();
+  }
+
+  fmt::print(os, "{} scans, {:.3f} ms of scan time\n\n", profiles.size(), Milliseconds(total_wall).count());
+  fmt::print(os, "{:>12} {:>12} {:>6} {:>14} {:>12} {:>8}  {}\n", "wall (ms)", "queue (ms)", "worker", "bytes", "candidates", "status", "name");
+  for (auto profile : sorted) {
+    fmt::print(os, "{:>12.3f} {:>12.3f} {:>6} {:>14} {:>12} {:>8}  {}\n",
+               Milliseconds(profile->WallTime()).count(),
+               Milliseconds(profile->QueueWait()).count(),
+               profile->worker.has_value() ? fmt::to_string(profile->worker.value()) : "-",
+               profile->stats.bytes_scanned,
+               profile->stats.candidates,
+               profile->status,
+               profile->name);
+  }
+}
+
+// Chrome trace event JSON, viewable in chrome://tracing or Perfetto. Each scan that started is one
+// complete event on the track of the worker that finished it; the rest are only counted in the report.
+inline void WriteProfileTrace(std::ostream& os, std::span<const ScanProfile> profiles) {
+  using Microseconds = std::chrono::duration<double, std::micro>;
+
+  auto origin = ScanProfile::Clock::time_point::max();
+  size_t other_tid = 0;
+  for (const auto& profile : profiles) {
+    origin = std::min(origin, profile.queued_at);
+    if (profile.worker.has_value()) {
+      other_tid = std::max(other_tid, profile.worker.value() + 1);
+    }
+  }
+
+  const char* separator = "";
+  auto write_event = [&](const std::string& event) {
+    fmt::print(os, "{}{}", separator, event);
+    separator = ",\n";
+  };
+
+  fmt::print(os, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t tid = 0; tid <= other_tid; tid++) {
+    write_event(fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", tid,
+                            tid < other_tid ? fmt::format("worker {}", tid) : "other"));
+  }
+
+  for (const auto& profile : profiles) {
+    if (!profile.Started()) {
+      continue;
+    }
+
+    write_event(fmt::format(
+        "{{\"name\":\"{}\",\"cat\":\"scan\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{},"
+        "\"args\":{{\"status\":\"{}\",\"queue_us\":{:.3f},\"bytes\":{},\"candidates\":{}}}}}",
+        EscapeJson(profile.name),
+        Microseconds(profile.started_at - origin).count(),
+        Microseconds(profile.WallTime()).count(),
+        profile.worker.value_or(other_tid),
+        profile.status,
+        Microseconds(profile.QueueWait()).count(),
+        profile.stats.bytes_scanned,
+        profile.stats.candidates));
+  }
+  fmt::print(os, "\n]}}\n");
+}
+}  // namespace oph
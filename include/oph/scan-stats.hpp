@@ -0,0 +1,50 @@
+#pragma once
+
+// C++ standard
+#include <cstdint>
+#include <utility>
+
+namespace oph {
+// Work done by the search primitives: bytes covered, and anchor hits (SigExpr, SigSet), values in
+// range (ValueScanner) or instructions (Decoder sweeps) examined on the way.
+struct ScanStats {
+  uint64_t bytes_scanned = 0;
+  uint64_t candidates = 0;
+
+  ScanStats& operator+=(const ScanStats& other) {
+    bytes_scanned += other.bytes_scanned;
+    candidates += other.candidates;
+    return *this;
+  }
+};
+
+// While a scope is alive, every search on its thread adds its totals to `stats`. Scopes nest; an
+// inner scope passes its totals on to the outer one when it ends.
+class ScanStatsScope {
+ public:
+  explicit ScanStatsScope(ScanStats& stats) : stats_(&stats), prev_(std::exchange(current_, &stats)) {}
+
+  ~ScanStatsScope() {
+    current_ = prev_;
+    if (prev_ != nullptr) {
+      *prev_ += *stats_;
+    }
+  }
+
+  static void Record(uint64_t bytes_scanned, uint64_t candidates) {
+    if (current_ != nullptr) {
+      current_->bytes_scanned += bytes_scanned;
+      current_->candidates += candidates;
+    }
+  }
+
+ private:
+  ScanStatsScope(const ScanStatsScope&) = delete;
+  ScanStatsScope& operator=(const ScanStatsScope&) = delete;
+
+  ScanStats* stats_;
+  ScanStats* prev_;
+
+  static inline thread_local ScanStats* current_ = nullptr;
+};
+}  // namespace oph
@@ -0,0 +1,215 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Other library
+#include <Zydis/Zydis.h>
+
+// This project
+#include "decoder.hpp"
+#include "memory.hpp"
+#include "sigexpr.hpp"
+#include "thread-pool.hpp"
+
+namespace oph {
+// Writes signatures for addresses in a section. A signature starts at its target and covers as few
+// bytes as it takes to match nowhere else in the section, with the displacement and immediate bytes
+// of every instruction wildcarded, since those are what change between builds.
+//
+// The section is indexed once by the hashes of its 4-byte grams. A uniqueness check only verifies the
+// positions sharing the rarest gram of the signature, so it costs a few hundred comparisons instead
+// of a scan. Signatures therefore need one run of 4 fixed bytes to be found unique.
+class SigGenerator {
+ public:
+  static constexpr size_t kDefaultMaxSize = 64;
+
+  // `section` must outlive the generator.
+  SigGenerator(Decoder& decoder, const Section& section) : decoder_(decoder), section_(section) {
+    auto dump = section_.GetDump();
+    if (dump.size() > UINT32_MAX) {
+      throw std::runtime_error(std::format("oph/sig-generator: section that is too large to index: {} bytes", dump.size()));
+    }
+
+    hash_bits_ = std::clamp<int>(std::bit_width(dump.size()) - 1, 8, 26);
+    gram_offsets_.assign(((size_t)1 << hash_bits_) + 1, 0);
+    if (dump.size() < kGramSize) {
+      return;
+    }
+
+    // Counting sort of the positions by gram hash, like SigSet::BuildIndex.
+    size_t num_grams = dump.size() - kGramSize + 1;
+    for (size_t pos = 0; pos < num_grams; pos++) {
+      gram_offsets_[HashGram(dump.data() + pos) + 1]++;
+    }
+    for (size_t i = 1; i < gram_offsets_.size(); i++) {
+      gram_offsets_[i] += gram_offsets_[i - 1];
+    }
+
+    gram_positions_.resize(num_grams);
+    std::vector<uint32_t> cursor(gram_offsets_.begin(), gram_offsets_.end() - 1);
+    for (size_t pos = 0; pos < num_grams; pos++) {
+      gram_positions_[cursor[HashGram(dump.data() + pos)]++] = (uint32_t)pos;
+    }
+  }
+
+  // Shortest signature starting at `address` (a VA in the section) that matches only there, in
+  // SigExpr syntax, or nullopt if none fits in `max_size` bytes.
+  std::optional<std::string> Generate(uint64_t address, size_t max_size = kDefaultMaxSize) {
+    auto dump = section_.GetDump();
+    if (address < section_.GetVA() || address - section_.GetVA() >= dump.size()) {
+      throw std::runtime_error(std::format("oph/sig-generator: address out of section: {:x}", address));
+    }
+
+    size_t start = address - section_.GetVA();
+    std::vector<uint8_t> fixed = DecodeMask(dump.subspan(start, std::min(max_size, dump.size() - start)));
+    auto bytes = dump.subspan(start, fixed.size());
+
+    // Every prefix ending in a fixed byte is a candidate; a longer prefix matches a subset of the
+    // positions a shorter one does, so the shortest unique one can be bisected.
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < fixed.size(); i++) {
+      if (fixed[i]) {
+        sizes.push_back(i + 1);
+      }
+    }
+    if (sizes.empty() || !IsUnique(bytes, fixed, sizes.back())) {
+      return std::nullopt;
+    }
+
+    size_t lo = 0, hi = sizes.size() - 1;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (IsUnique(bytes, fixed, sizes[mid])) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return Format(bytes, fixed, sizes[lo]);
+  }
+
+  // Generates the signatures of `addresses` concurrently on `pool`. Result `i` belongs to the `i`th
+  // address.
+  std::vector<std::optional<std::string>> Generate(ThreadPool& pool, std::span<const uint64_t> addresses, size_t max_size = kDefaultMaxSize) {
+    std::vector<std::optional<std::string>> result(addresses.size());
+    pool.ParallelFor(0, addresses.size(), 1, [&](size_t i) { result[i] = Generate(addresses[i], max_size); });
+    return result;
+  }
+
+ private:
+  static constexpr size_t kGramSize = 4;
+
+  SigGenerator(const SigGenerator&) = delete;
+  SigGenerator(SigGenerator&&) noexcept = delete;
+  SigGenerator& operator=(const SigGenerator&) = delete;
+  SigGenerator& operator=(SigGenerator&&) noexcept = delete;
+
+  uint32_t HashGram(const uint8_t* ptr) const {
+    uint32_t gram;
+    std::memcpy(&gram, ptr, kGramSize);
+    return (gram * 0x9E3779B1u) >> (32 - hash_bits_);
+  }
+
+  // 1 for each byte of `code` that is kept, 0 for each one that is wildcarded. Stops at the first
+  // instruction that does not decode or does not fit.
+  std::vector<uint8_t> DecodeMask(std::span<const uint8_t> code) {
+    std::vector<uint8_t> fixed;
+    ZydisDecodedInstruction instruction;
+    while (fixed.size() < code.size() &&
+           ZYAN_SUCCESS(decoder_.DecodeInstruction(code.data() + fixed.size(), code.size() - fixed.size(), &instruction))) {
+      size_t begin = fixed.size();
+      fixed.resize(begin + instruction.length, 1);
+
+      auto wildcard = [&](ZyanU8 offset, ZyanU8 size) {
+        std::fill_n(fixed.begin() + begin + offset, size, 0);
+      };
+      if (instruction.raw.disp.size != 0) {
+        wildcard(instruction.raw.disp.offset, instruction.raw.disp.size / 8);
+      }
+      for (const auto& imm : instruction.raw.imm) {
+        if (imm.size != 0) {
+          wildcard(imm.offset, imm.size / 8);
+        }
+      }
+    }
+    return fixed;
+  }
+
+  // Whether the first `size` bytes of the pattern match only once in the section.
+  bool IsUnique(std::span<const uint8_t> bytes, const std::vector<uint8_t>& fixed, size_t size) const {
+    auto dump = section_.GetDump();
+
+    // Anchor on the fully fixed gram with the fewest positions.
+    std::optional<size_t> anchor;
+    size_t anchor_count = SIZE_MAX;
+    for (size_t i = 0, run = 0; i < size; i++) {
+      run = fixed[i] ? run + 1 : 0;
+      if (run < kGramSize) {
+        continue;
+      }
+
+      size_t offset = i + 1 - kGramSize;
+      uint32_t key = HashGram(bytes.data() + offset);
+      size_t count = gram_offsets_[key + 1] - gram_offsets_[key];
+      if (count < anchor_count) {
+        anchor = offset;
+        anchor_count = count;
+      }
+    }
+    if (!anchor.has_value()) {
+      return false;
+    }
+
+    uint32_t key = HashGram(bytes.data() + anchor.value());
+    size_t num_matches = 0;
+    for (uint32_t i = gram_offsets_[key]; i < gram_offsets_[key + 1]; i++) {
+      size_t pos = gram_positions_[i];
+      if (pos < anchor.value() || pos - anchor.value() + size > dump.size()) {
+        continue;
+      }
+
+      const uint8_t* ptr = dump.data() + pos - anchor.value();
+      bool matched = true;
+      for (size_t j = 0; j < size && matched; j++) {
+        matched = !fixed[j] || ptr[j] == bytes[j];
+      }
+      if (matched && ++num_matches > 1) {
+        return false;
+      }
+    }
+    return num_matches == 1;
+  }
+
+  static std::string Format(std::span<const uint8_t> bytes, const std::vector<uint8_t>& fixed, size_t size) {
+    std::string expr;
+    for (size_t i = 0; i < size; i++) {
+      if (i > 0) {
+        expr += ' ';
+      }
+      if (fixed[i]) {
+        expr += kHexTable[bytes[i] >> 4];
+        expr += kHexTable[bytes[i] & 0x0f];
+      } else {
+        expr += '?';
+      }
+    }
+    return expr;
+  }
+
+  Decoder& decoder_;
+  const Section& section_;
+  int hash_bits_;
+  std::vector<uint32_t> gram_offsets_;
+  std::vector<uint32_t> gram_positions_;
+};
+}  // namespace oph
@@ -0,0 +1,137 @@
+#pragma once
+
+// C++ standard
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// This project
+#include "decoder.hpp"
+#include "memory.hpp"
+#include "sigexpr.hpp"
+
+namespace oph {
+// Declarative form of the usual "search a signature in one section, then post-process the hit" scan.
+// Unlike an opaque scan function, Patcher can see which section it reads and fuse it with every other
+// SigScan of that section into one pass.
+//
+// The value starts as the section-relative offset of the `peek`th of exactly `total` matches and is
+// transformed by the steps in the order they were added.
+class SigScan {
+ public:
+  SigScan(std::string_view module_name, std::string_view section_name, const SigExpr& sig, size_t total = 1, size_t peek = 0)
+      : module_name_(module_name), section_name_(section_name), sig_(sig), total_(total), peek_(peek) {}
+
+  // value += `value`
+  SigScan& Add(int64_t value) {
+    steps_.push_back({Step::kAdd, value});
+    return *this;
+  }
+
+  // value = target of the relative operand of the instruction at value
+  SigScan& FollowRel(Decoder& decoder, ZydisMnemonic mnemonic, ZyanU8 operand_index) {
+    steps_.push_back({Step::kFollowRel, 0, &decoder, mnemonic, operand_index});
+    return *this;
+  }
+
+  // value = displacement of the memory operand of the instruction at value
+  SigScan& ReadDisp(Decoder& decoder, ZydisMnemonic mnemonic, ZyanU8 operand_index) {
+    steps_.push_back({Step::kReadDisp, 0, &decoder, mnemonic, operand_index});
+    return *this;
+  }
+
+  // value += section VA
+  SigScan& ToVA() {
+    steps_.push_back({Step::kToVA});
+    return *this;
+  }
+
+  // value += section RVA
+  SigScan& ToRVA() {
+    steps_.push_back({Step::kToRVA});
+    return *this;
+  }
+
+  const std::string& GetModuleName() const { return module_name_; }
+
+  const std::string& GetSectionName() const { return section_name_; }
+
+  const SigExpr& GetSig() const { return sig_; }
+
+  // Applies the steps to the matches of the signature in `section`.
+  uint64_t Resolve(const Section& section, std::span<const uint64_t> matches) const {
+    if (total_ <= peek_) {
+      throw std::runtime_error("oph/sig-scan: peek-index out of range");
+    }
+    if (matches.size() != total_) {
+      throw std::runtime_error(std::format("oph/sig-scan: unexpected search result size: expected({}), result({})", total_, matches.size()));
+    }
+
+    auto dump = section.GetDump();
+    uint64_t value = matches[peek_];
+    for (const auto& step : steps_) {
+      std::optional<uint64_t> next;
+      switch (step.type) {
+        case Step::kAdd:
+          next = value + step.value;
+          break;
+        case Step::kFollowRel:
+          next = step.decoder->CalcAbsAddr(dump, value, step.mnemonic, step.operand_index);
+          break;
+        case Step::kReadDisp:
+          if (value < dump.size()) {
+            next = step.decoder->DecodeDispValue(dump.subspan(value), step.mnemonic, step.operand_index);
+          }
+          break;
+        case Step::kToVA:
+          next = value + section.GetVA();
+          break;
+        case Step::kToRVA:
+          next = value + section.GetRVA();
+          break;
+      }
+
+      if (!next.has_value()) {
+        throw std::runtime_error(std::format("oph/sig-scan: step {} failed at {:x}", (size_t)(&step - steps_.data()), value));
+      }
+      value = next.value();
+    }
+    return value;
+  }
+
+  // Runs the scan on its own, e.g. outside of Patcher.
+  uint64_t operator()(const DumpStore& store) const {
+    const auto& section = store.GetSection(module_name_, section_name_);
+    return Resolve(section, sig_.Search(section.GetDump()));
+  }
+
+ private:
+  struct Step {
+    enum Type {
+      kAdd,
+      kFollowRel,
+      kReadDisp,
+      kToVA,
+      kToRVA,
+    };
+
+    Type type;
+    int64_t value = 0;
+    Decoder* decoder = nullptr;
+    ZydisMnemonic mnemonic = ZYDIS_MNEMONIC_INVALID;
+    ZyanU8 operand_index = 0;
+  };
+
+  std::string module_name_;
+  std::string section_name_;
+  SigExpr sig_;
+  size_t total_;
+  size_t peek_;
+  std::vector<Step> steps_;
+};
+}  // namespace oph
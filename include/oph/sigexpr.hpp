@@ -1,15 +1,25 @@
 #pragma once
 
 // C++ standard
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <format>
+#include <mutex>
 #include <optional>
 #include <ranges>
 #include <span>
 #include <stdexcept>
+#include <stop_token>
 #include <string_view>
 #include <vector>
 
+// This project
+#include "cancellation.hpp"
+#include "counters.hpp"
+#include "scan-stats.hpp"
+#include "thread-pool.hpp"
+
 namespace oph {
 constexpr const char* kHexTable = "0123456789ABCDEF";
 constexpr const char* kReverseHexTable =
@@ -30,6 +40,8 @@ constexpr const char* kReverseHexTable =
     "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
     "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff";
 
+class SigSet;
+
 class SigExpr {
  public:
   SigExpr(const char* expr) : SigExpr(std::string_view(expr)) {}
@@ -47,55 +59,88 @@ class SigExpr {
       return false;
     }
 
-    const uint8_t* ptr = buffer.data();
-    for (size_t i = scan_begin_; i < scan_end_; i++) {
-      if (elems_[i].mask == 0 && elems_[i].value != ptr[i]) {
-        return false;
-      }
-    }
-    return true;
+    bool matched = MatchAt(buffer.data(), scan_begin_);
+    Counters::Add(Counters::kSigVerifications, 1);
+    Counters::Add(Counters::kSigMatches, matched);
+    return matched;
   }
 
   uint64_t Search(std::span<const uint8_t> buffer, size_t total, size_t peek, uint64_t base_addr = 0) const {
+    return Search(buffer, std::stop_token(), total, peek, base_addr);
+  }
+
+  std::vector<uint64_t> Search(std::span<const uint8_t> buffer, uint64_t base_addr = 0) const {
+    return Search(buffer, std::stop_token(), base_addr);
+  }
+
+  // Same as above, but throws Cancelled once `stoken` is triggered. The token is checked every 64K
+  // positions, so an unlucky signature cannot keep a cancelled scan running for long.
+  uint64_t Search(std::span<const uint8_t> buffer, std::stop_token stoken, size_t total, size_t peek, uint64_t base_addr = 0) const {
     if (total <= peek) {
       throw std::runtime_error("oph/sigexpr: peek-index out of range");
     }
 
-    auto result = Search(buffer, base_addr);
+    auto result = Search(buffer, stoken, base_addr);
     if (result.size() != total) {
       throw std::runtime_error(std::format("oph/sigexpr: unexpected search result size: expected({}), result({})", total, result.size()));
     }
     return result[peek];
   }
 
-  std::vector<uint64_t> Search(std::span<const uint8_t> buffer, uint64_t base_addr = 0) const {
+  std::vector<uint64_t> Search(std::span<const uint8_t> buffer, std::stop_token stoken, uint64_t base_addr = 0) const {
     std::vector<uint64_t> result;
 
     if (elems_.size() > buffer.size() || scan_begin_ >= scan_end_) {
       return result;
     }
 
+    // The first fixed byte is the anchor; only positions where it matches are verified further.
+    const uint8_t anchor = elems_[scan_begin_].value;
+    uint64_t num_candidates = 0;
+
     const uint8_t* buffer_begin = buffer.data();
     const uint8_t* buffer_end = buffer_begin + buffer.size() - elems_.size() + 1;
-    for (const uint8_t* ptr = buffer_begin; ptr != buffer_end; ptr++) {
-      bool matched = [&]() {
-        for (size_t i = scan_begin_; i < scan_end_; i++) {
-          if (elems_[i].mask == 0 && elems_[i].value != ptr[i]) {
-            return false;
-          }
+    for (const uint8_t* block = buffer_begin; block != buffer_end;) {
+      ThrowIfStopRequested(stoken);
+
+      const uint8_t* block_end = buffer_end - block > (ptrdiff_t)kStopCheckInterval ? block + kStopCheckInterval : buffer_end;
+      for (const uint8_t* ptr = block; ptr != block_end; ptr++) {
+        if (ptr[scan_begin_] != anchor) {
+          continue;
         }
-        return true;
-      }();
 
-      if (matched) {
-        result.push_back(base_addr + (uint64_t)(ptr - buffer_begin));
+        num_candidates++;
+        if (MatchAt(ptr, scan_begin_ + 1)) {
+          result.push_back(base_addr + (uint64_t)(ptr - buffer_begin));
+        }
       }
+      block = block_end;
     }
+    ScanStatsScope::Record(buffer.size(), num_candidates);
+
+    Counters::Add(Counters::kSigBytesScanned, buffer.size());
+    Counters::Add(Counters::kSigCandidates, num_candidates);
+    Counters::Add(Counters::kSigVerifications, num_candidates);
+    Counters::Add(Counters::kSigMatches, result.size());
 
     return result;
   }
 
  private:
+  friend class SigSet;
+
+  static constexpr size_t kStopCheckInterval = 1 << 16;
+
+  // Compares the fixed bytes from `begin` on; `ptr` must have room for the whole signature.
+  bool MatchAt(const uint8_t* ptr, size_t begin) const {
+    for (size_t i = begin; i < scan_end_; i++) {
+      if (elems_[i].mask == 0 && elems_[i].value != ptr[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   struct Elem {
     uint8_t value;
     uint8_t mask;
@@ -144,6 +189,229 @@ class SigExpr {
   const size_t scan_end_;
 };
 
+// Searches a buffer for many signatures in a single pass. Each signature is keyed by its rarest pair
+// of adjacent fixed bytes (or a single fixed byte when it has no such pair), so every position costs
+// one table lookup and only the signatures sharing that key are verified.
+class SigSet {
+ public:
+  SigSet(std::vector<const SigExpr*> sigs)
+      : sigs_(std::move(sigs)), pair_offsets_(kNumPairKeys + 1, 0), byte_offsets_(kNumByteKeys + 1, 0), max_anchor_(0) {
+    std::vector<std::pair<size_t, Anchor>> pair_anchors, byte_anchors;
+    for (size_t i = 0; i < sigs_.size(); i++) {
+      const SigExpr& sig = *sigs_[i];
+      if (sig.scan_begin_ >= sig.scan_end_) {
+        continue;
+      }
+
+      auto [offset, is_pair] = ChooseAnchor(sig);
+      max_anchor_ = std::max(max_anchor_, offset);
+      if (is_pair) {
+        pair_anchors.emplace_back(sig.elems_[offset].value | (sig.elems_[offset + 1].value << 8), Anchor{(uint32_t)i, (uint32_t)offset});
+      } else {
+        byte_anchors.emplace_back(sig.elems_[offset].value, Anchor{(uint32_t)i, (uint32_t)offset});
+      }
+    }
+
+    pair_anchors_ = BuildIndex(pair_anchors, pair_offsets_);
+    byte_anchors_ = BuildIndex(byte_anchors, byte_offsets_);
+  }
+
+  size_t Size() const { return sigs_.size(); }
+
+  // Result `i` holds the matches of the `i`th signature, in ascending order.
+  std::vector<std::vector<uint64_t>> Search(std::span<const uint8_t> buffer, uint64_t base_addr = 0) const {
+    return Search(buffer, std::stop_token(), 0, buffer.size(), base_addr);
+  }
+
+  // Only reports matches starting in [begin, end), so disjoint ranges of one buffer can be searched
+  // independently (e.g. with ThreadPool::ParallelReduce) and concatenated.
+  std::vector<std::vector<uint64_t>> Search(std::span<const uint8_t> buffer, size_t begin, size_t end, uint64_t base_addr = 0) const {
+    return Search(buffer, std::stop_token(), begin, end, base_addr);
+  }
+
+  // Same as above, but throws Cancelled once `stoken` is triggered, like SigExpr::Search.
+  std::vector<std::vector<uint64_t>> Search(std::span<const uint8_t> buffer, std::stop_token stoken, size_t begin, size_t end, uint64_t base_addr = 0) const {
+    std::vector<std::vector<uint64_t>> result(sigs_.size());
+
+    const uint8_t* data = buffer.data();
+    size_t size = buffer.size();
+    size_t scan_end = std::min(size, end + max_anchor_);
+    uint64_t num_candidates = 0;
+    uint64_t num_verifications = 0;
+    uint64_t num_matches = 0;
+    auto verify = [&](const Anchor& anchor, size_t pos) {
+      if (pos < begin + anchor.offset) {
+        return;
+      }
+
+      num_candidates++;
+
+      const SigExpr& sig = *sigs_[anchor.sig_index];
+      size_t start = pos - anchor.offset;
+      if (start >= end || start + sig.elems_.size() > size) {
+        return;
+      }
+
+      num_verifications++;
+      if (sig.MatchAt(data + start, sig.scan_begin_)) {
+        result[anchor.sig_index].push_back(base_addr + start);
+        num_matches++;
+      }
+    };
+
+    bool has_pairs = !pair_anchors_.empty();
+    bool has_bytes = !byte_anchors_.empty();
+    for (size_t pos = begin; pos < scan_end; pos++) {
+      if ((pos - begin) % SigExpr::kStopCheckInterval == 0) {
+        ThrowIfStopRequested(stoken);
+      }
+      if (has_pairs && pos + 1 < size) {
+        size_t key = data[pos] | (data[pos + 1] << 8);
+        for (uint32_t i = pair_offsets_[key]; i < pair_offsets_[key + 1]; i++) {
+          verify(pair_anchors_[i], pos);
+        }
+      }
+      if (has_bytes) {
+        size_t key = data[pos];
+        for (uint32_t i = byte_offsets_[key]; i < byte_offsets_[key + 1]; i++) {
+          verify(byte_anchors_[i], pos);
+        }
+      }
+    }
+
+    ScanStatsScope::Record(scan_end > begin ? scan_end - begin : 0, num_candidates);
+
+    Counters::Add(Counters::kSigBytesScanned, scan_end > begin ? scan_end - begin : 0);
+    Counters::Add(Counters::kSigCandidates, num_candidates);
+    Counters::Add(Counters::kSigVerifications, num_verifications);
+    Counters::Add(Counters::kSigMatches, num_matches);
+
+    return result;
+  }
+
+  // Splits `buffer` into chunks searched concurrently on `pool`. The work of every chunk is added to
+  // `stats`, whichever thread ran it, and `check_chunk` is called before each one so that the
+  // caller can stop the search by throwing, e.g. Cancelled.
+  template <typename CheckChunk>
+  std::vector<std::vector<uint64_t>> Search(ThreadPool& pool, std::span<const uint8_t> buffer, std::stop_token stoken, ScanStats& stats, CheckChunk&& check_chunk) const {
+    std::mutex stats_mutex;
+    return pool.ParallelReduce(
+        0, buffer.size(), kParallelGrain, std::vector<std::vector<uint64_t>>(sigs_.size()),
+        [&](size_t begin, size_t end) {
+          check_chunk();
+
+          ScanStats chunk_stats;
+          auto chunk_matches = [&] {
+            ScanStatsScope stats_scope(chunk_stats);
+            return Search(buffer, stoken, begin, end);
+          }();
+          std::lock_guard<std::mutex> lock(stats_mutex);
+          stats += chunk_stats;
+          return chunk_matches;
+        },
+        [](std::vector<std::vector<uint64_t>> lhs, std::vector<std::vector<uint64_t>> rhs) {
+          for (size_t i = 0; i < lhs.size(); i++) {
+            lhs[i].insert(lhs[i].end(), rhs[i].begin(), rhs[i].end());
+          }
+          return lhs;
+        });
+  }
+
+  std::vector<std::vector<uint64_t>> Search(ThreadPool& pool, std::span<const uint8_t> buffer, std::stop_token stoken = {}) const {
+    ScanStats stats;
+    return Search(pool, buffer, std::move(stoken), stats, [] {});
+  }
+
+ private:
+  // Chunk size of the pooled Search.
+  static constexpr size_t kParallelGrain = 1 << 20;
+
+  static constexpr size_t kNumPairKeys = 0x10000;
+  static constexpr size_t kNumByteKeys = 0x100;
+
+  struct Anchor {
+    uint32_t sig_index;
+    uint32_t offset;
+  };
+
+  // Rough commonness of a byte in x86 code; lower is rarer.
+  static uint8_t ByteWeight(uint8_t byte) {
+    switch (byte) {
+      case 0x00:
+      case 0xFF:
+      case 0xCC:
+        return 4;
+      case 0x48:
+      case 0x8B:
+      case 0x89:
+      case 0x0F:
+      case 0x90:
+        return 3;
+      case 0xE8:
+      case 0x83:
+      case 0x8D:
+      case 0x4C:
+      case 0x24:
+      case 0x44:
+      case 0x85:
+      case 0xC3:
+        return 2;
+      default:
+        return 1;
+    }
+  }
+
+  static std::pair<size_t, bool> ChooseAnchor(const SigExpr& sig) {
+    const auto& elems = sig.elems_;
+
+    size_t best_offset = sig.scan_begin_;
+    size_t best_weight = SIZE_MAX;
+    for (size_t i = sig.scan_begin_; i + 1 < sig.scan_end_; i++) {
+      if (elems[i].mask == 0 && elems[i + 1].mask == 0) {
+        size_t weight = ByteWeight(elems[i].value) + ByteWeight(elems[i + 1].value);
+        if (weight < best_weight) {
+          best_offset = i;
+          best_weight = weight;
+        }
+      }
+    }
+    if (best_weight != SIZE_MAX) {
+      return {best_offset, true};
+    }
+
+    for (size_t i = sig.scan_begin_; i < sig.scan_end_; i++) {
+      if (elems[i].mask == 0 && ByteWeight(elems[i].value) < best_weight) {
+        best_offset = i;
+        best_weight = ByteWeight(elems[i].value);
+      }
+    }
+    return {best_offset, false};
+  }
+
+  static std::vector<Anchor> BuildIndex(const std::vector<std::pair<size_t, Anchor>>& anchors, std::vector<uint32_t>& offsets) {
+    for (const auto& [key, anchor] : anchors) {
+      offsets[key + 1]++;
+    }
+    for (size_t i = 1; i < offsets.size(); i++) {
+      offsets[i] += offsets[i - 1];
+    }
+
+    std::vector<Anchor> index(anchors.size());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (const auto& [key, anchor] : anchors) {
+      index[cursor[key]++] = anchor;
+    }
+    return index;
+  }
+
+  std::vector<const SigExpr*> sigs_;
+  std::vector<Anchor> pair_anchors_;
+  std::vector<uint32_t> pair_offsets_;
+  std::vector<Anchor> byte_anchors_;
+  std::vector<uint32_t> byte_offsets_;
+  size_t max_anchor_;
+};
+
 static inline SigExpr operator""_sig(const char* str, size_t size) {
   std::string expr;
   if (size > 0) {
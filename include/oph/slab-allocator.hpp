@@ -0,0 +1,172 @@
+#pragma once
+
+// C++ standard
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace oph {
+// Fixed-size block allocator backing the small, short-lived objects of a ThreadPool (queued tasks and
+// future shared states). Freed blocks go to a lock-free free list and are reused, so steady-state
+// allocation never reaches the heap. Objects that do not fit in a block fall back to `new`.
+//
+// The allocator is reference counted: the owner holds one reference and every live block holds one,
+// so a block released after the owner is gone (e.g. a future outliving its pool) is still valid.
+class SlabAllocator {
+ public:
+  static constexpr size_t kBlockSize = 128;
+  static constexpr size_t kPayloadOffset = 16;
+  static constexpr size_t kPayloadSize = kBlockSize - kPayloadOffset;
+
+  template <typename T>
+  static constexpr bool kFits = sizeof(T) <= kPayloadSize && alignof(T) <= kPayloadOffset;
+
+  static SlabAllocator* Create() {
+    return new SlabAllocator();
+  }
+
+  void Ref() {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Unref() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    if constexpr (kFits<T>) {
+      Block* block = Allocate();
+      try {
+        return new (block->payload) T(std::forward<Args>(args)...);
+      } catch (...) {
+        Free(block);
+        throw;
+      }
+    } else {
+      return new T(std::forward<Args>(args)...);
+    }
+  }
+
+  template <typename T>
+  void Delete(T* ptr) {
+    if constexpr (kFits<T>) {
+      ptr->~T();
+      Free(reinterpret_cast<Block*>(reinterpret_cast<std::byte*>(ptr) - kPayloadOffset));
+    } else {
+      delete ptr;
+    }
+  }
+
+ private:
+  static constexpr size_t kBlocksPerChunk = 512;
+  static constexpr size_t kMaxChunks = 2048;
+  static constexpr uint32_t kNullIndex = UINT32_MAX;
+  static constexpr uint32_t kHeapIndex = UINT32_MAX - 1;
+
+  struct alignas(64) Block {
+    uint32_t index;
+    std::atomic_uint32_t next;
+    alignas(kPayloadOffset) std::byte payload[kPayloadSize];
+  };
+  static_assert(sizeof(Block) == kBlockSize && offsetof(Block, payload) == kPayloadOffset);
+
+  SlabAllocator() : refs_(1), head_(Pack(kNullIndex, 0)), num_chunks_(0) {}
+
+  ~SlabAllocator() {
+    size_t num_chunks = num_chunks_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_chunks; i++) {
+      delete[] chunks_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator(SlabAllocator&&) noexcept = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(SlabAllocator&&) noexcept = delete;
+
+  static uint64_t Pack(uint32_t index, uint32_t tag) {
+    return ((uint64_t)tag << 32) | index;
+  }
+
+  Block* BlockAt(uint32_t index) const {
+    return chunks_[index / kBlocksPerChunk].load(std::memory_order_acquire) + index % kBlocksPerChunk;
+  }
+
+  Block* Allocate() {
+    Ref();
+
+    // The tag is bumped on every successful exchange so a stale `next` read never wins (ABA).
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      uint32_t index = (uint32_t)head;
+      if (index == kNullIndex) {
+        if (!Grow()) {
+          auto block = new Block;
+          block->index = kHeapIndex;
+          return block;
+        }
+        head = head_.load(std::memory_order_acquire);
+        continue;
+      }
+
+      Block* block = BlockAt(index);
+      uint32_t next = block->next.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, Pack(next, (uint32_t)(head >> 32) + 1), std::memory_order_acquire)) {
+        return block;
+      }
+    }
+  }
+
+  void Free(Block* block) {
+    if (block->index == kHeapIndex) {
+      delete block;
+    } else {
+      Push(block, block);
+    }
+    Unref();
+  }
+
+  void Push(Block* first, Block* last) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    do {
+      last->next.store((uint32_t)head, std::memory_order_relaxed);
+    } while (!head_.compare_exchange_weak(head, Pack(first->index, (uint32_t)(head >> 32) + 1), std::memory_order_release));
+  }
+
+  bool Grow() {
+    std::lock_guard<std::mutex> lock(grow_mutex_);
+    if ((uint32_t)head_.load(std::memory_order_acquire) != kNullIndex) {
+      return true;
+    }
+
+    size_t chunk_index = num_chunks_.load(std::memory_order_relaxed);
+    if (chunk_index == kMaxChunks) {
+      return false;
+    }
+
+    auto chunk = new Block[kBlocksPerChunk];
+    for (size_t i = 0; i < kBlocksPerChunk; i++) {
+      chunk[i].index = (uint32_t)(chunk_index * kBlocksPerChunk + i);
+      chunk[i].next.store(chunk[i].index + 1, std::memory_order_relaxed);
+    }
+    chunks_[chunk_index].store(chunk, std::memory_order_release);
+    num_chunks_.store(chunk_index + 1, std::memory_order_relaxed);
+
+    Push(chunk, chunk + kBlocksPerChunk - 1);
+    return true;
+  }
+
+  std::atomic_uint32_t refs_;
+  alignas(64) std::atomic_uint64_t head_;
+  std::array<std::atomic<Block*>, kMaxChunks> chunks_;
+  std::atomic_size_t num_chunks_;
+  std::mutex grow_mutex_;
+};
+}  // namespace oph
@@ -0,0 +1,325 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Other library
+#include <Zydis/Zydis.h>
+
+// This project
+#include "decoder.hpp"
+#include "memory.hpp"
+#include "thread-pool.hpp"
+
+// Widest instruction set StringIndex uses: 1 for SSE2, 0 for none. SSE2 is part of x86-64.
+#ifndef OPH_STRING_INDEX_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OPH_STRING_INDEX_SIMD 1
+#else
+#define OPH_STRING_INDEX_SIMD 0
+#endif
+#endif
+
+#if OPH_STRING_INDEX_SIMD > 0
+#include <emmintrin.h>
+#endif
+
+namespace oph {
+// The null-terminated strings of a data section (e.g. .rdata) and the instructions of a code section
+// that load their addresses, for offsets of the form "the function that references string X".
+//
+// Strings are runs of printable ASCII, either as bytes or as 2-byte aligned UTF-16LE code units.
+// References are found without decoding the whole code section: every 4 bytes are read as a
+// RIP-relative displacement and as an absolute address, and only the positions that land in the data
+// section are decoded, from each instruction start that could hold a field there.
+class StringIndex {
+ public:
+  enum Encoding {
+    kAscii,
+    kUtf16,
+  };
+
+  struct String {
+    uint64_t address;
+    Encoding encoding;
+    std::string text;
+    // VAs of the instructions that load `address`, in ascending order.
+    std::vector<uint64_t> refs;
+  };
+
+  static constexpr size_t kDefaultMinLength = 4;
+
+  // `min_length` is in characters, not counting the terminator.
+  StringIndex(Decoder& decoder, const Section& code_section, const Section& data_section, size_t min_length = kDefaultMinLength)
+      : data_va_(data_section.GetVA()), data_size_(data_section.GetDump().size()) {
+    Extract(data_section, min_length);
+    auto refs = FindRefs(decoder, code_section, 0, code_section.GetDump().size());
+    LinkRefs(refs);
+  }
+
+  // Same as above, but splits the code section into chunks searched concurrently on `pool`.
+  StringIndex(ThreadPool& pool, Decoder& decoder, const Section& code_section, const Section& data_section, size_t min_length = kDefaultMinLength)
+      : data_va_(data_section.GetVA()), data_size_(data_section.GetDump().size()) {
+    Extract(data_section, min_length);
+    auto refs = pool.ParallelReduce(
+        0, code_section.GetDump().size(), kParallelGrain, std::vector<Ref>(),
+        [&](size_t begin, size_t end) { return FindRefs(decoder, code_section, begin, end); },
+        [](std::vector<Ref> lhs, std::vector<Ref> rhs) {
+          lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+          return lhs;
+        });
+    LinkRefs(refs);
+  }
+
+  // In ascending order of address.
+  const std::vector<String>& GetStrings() const { return strings_; }
+
+  // Every occurrence of `text` in the data section.
+  std::vector<const String*> Find(std::string_view text, Encoding encoding = kAscii) const {
+    std::vector<const String*> result;
+    auto iter = by_text_[encoding].find(std::string(text));
+    if (iter != by_text_[encoding].end()) {
+      for (uint32_t index : iter->second) {
+        result.push_back(&strings_[index]);
+      }
+    }
+    return result;
+  }
+
+  // VAs of the instructions that load any occurrence of `text`, in ascending order.
+  std::vector<uint64_t> FindRefs(std::string_view text, Encoding encoding = kAscii) const {
+    std::vector<uint64_t> result;
+    for (const String* string : Find(text, encoding)) {
+      result.insert(result.end(), string->refs.begin(), string->refs.end());
+    }
+    std::ranges::sort(result);
+    return result;
+  }
+
+ private:
+  static constexpr size_t kParallelGrain = 1 << 20;
+  // A 4-byte field of an instruction lies at most this many bytes after its start.
+  static constexpr size_t kMaxFieldOffset = ZYDIS_MAX_INSTRUCTION_LENGTH - 4;
+
+  struct Ref {
+    uint32_t string_index;
+    uint64_t site;
+  };
+
+  static bool IsPrintable(uint8_t byte) {
+    return (uint8_t)(byte - 0x20) <= 0x7E - 0x20 || byte == '\t' || byte == '\n' || byte == '\r';
+  }
+
+  // Bit i of the result is set if byte i of `data` is printable; bit i of `zero` if it is 0.
+  static std::vector<uint64_t> Classify(std::span<const uint8_t> data, std::vector<uint64_t>& zero) {
+    std::vector<uint64_t> printable((data.size() + 63) / 64, 0);
+    zero.assign(printable.size(), 0);
+
+    size_t i = 0;
+#if OPH_STRING_INDEX_SIMD >= 1
+    // Same range trick as IsPrintable; SSE2 only has signed compares, so the bytes are biased.
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i low = _mm_set1_epi8((char)(0x20 ^ 0x80));
+    const __m128i high = _mm_set1_epi8((char)(0x7E ^ 0x80));
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i nul = _mm_setzero_si128();
+    for (; i + 64 <= data.size(); i += 64) {
+      uint64_t printable_bits = 0, zero_bits = 0;
+      for (size_t j = 0; j < 64; j += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data.data() + i + j));
+        __m128i biased = _mm_xor_si128(bytes, bias);
+        __m128i in_range = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi8(biased, low), _mm_cmpgt_epi8(biased, high)), _mm_set1_epi8(-1));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_or_si128(_mm_cmpeq_epi8(bytes, lf), _mm_cmpeq_epi8(bytes, cr)));
+        printable_bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(in_range, space)) << j;
+        zero_bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nul)) << j;
+      }
+      printable[i / 64] = printable_bits;
+      zero[i / 64] = zero_bits;
+    }
+#endif
+
+    for (; i < data.size(); i++) {
+      printable[i / 64] |= (uint64_t)IsPrintable(data[i]) << (i % 64);
+      zero[i / 64] |= (uint64_t)(data[i] == 0) << (i % 64);
+    }
+    return printable;
+  }
+
+  // First position from `pos` on whose bit equals `value`, or `size` if there is none.
+  static size_t FindBit(const std::vector<uint64_t>& bits, size_t pos, bool value, size_t size) {
+    while (pos < size) {
+      uint64_t word = (value ? bits[pos / 64] : ~bits[pos / 64]) >> (pos % 64);
+      if (word != 0) {
+        return std::min(pos + std::countr_zero(word), size);
+      }
+      pos = (pos / 64 + 1) * 64;
+    }
+    return size;
+  }
+
+  void Extract(const Section& data_section, size_t min_length) {
+    auto data = data_section.GetDump();
+    size_t size = data.size();
+    std::vector<uint64_t> zero;
+    std::vector<uint64_t> printable = Classify(data, zero);
+
+    // ASCII: maximal printable runs followed by a 0.
+    for (size_t pos = FindBit(printable, 0, true, size); pos < size;) {
+      size_t end = FindBit(printable, pos, false, size);
+      if (end - pos >= min_length && end < size && data[end] == 0) {
+        AddString(data_va_ + pos, kAscii, std::string((const char*)data.data() + pos, end - pos));
+      }
+      pos = FindBit(printable, end, true, size);
+    }
+
+    // UTF-16LE: even positions holding a printable byte followed by a 0, which is the same bitmap
+    // shifted down by one.
+    std::vector<uint64_t> units(printable.size());
+    for (size_t i = 0; i < units.size(); i++) {
+      uint64_t next_zero = (zero[i] >> 1) | (i + 1 < units.size() ? zero[i + 1] << 63 : 0);
+      units[i] = printable[i] & next_zero & 0x5555555555555555;
+    }
+    for (size_t pos = FindBit(units, 0, true, size); pos < size;) {
+      size_t end = pos;
+      while (end < size && (units[end / 64] >> (end % 64) & 1)) {
+        end += 2;
+      }
+      if ((end - pos) / 2 >= min_length && end + 1 < size && data[end] == 0 && data[end + 1] == 0) {
+        std::string text;
+        for (size_t i = pos; i < end; i += 2) {
+          text += (char)data[i];
+        }
+        AddString(data_va_ + pos, kUtf16, std::move(text));
+      }
+      pos = FindBit(units, end, true, size);
+    }
+
+    // Both passes yield ascending addresses; merge them and index the result.
+    auto utf16_begin = std::ranges::find_if(strings_, [](const String& string) { return string.encoding == kUtf16; });
+    std::inplace_merge(strings_.begin(), utf16_begin, strings_.end(), [](const String& lhs, const String& rhs) { return lhs.address < rhs.address; });
+    for (size_t i = 0; i < strings_.size(); i++) {
+      by_text_[strings_[i].encoding][strings_[i].text].push_back((uint32_t)i);
+      by_address_.emplace(strings_[i].address, (uint32_t)i);
+    }
+  }
+
+  void AddString(uint64_t address, Encoding encoding, std::string&& text) {
+    strings_.push_back({address, encoding, std::move(text), {}});
+  }
+
+  // References whose 4-byte field starts in [begin, end) of the code section.
+  std::vector<Ref> FindRefs(Decoder& decoder, const Section& code_section, size_t begin, size_t end) const {
+    std::vector<Ref> result;
+    if (strings_.empty()) {
+      return result;
+    }
+
+    auto code = code_section.GetDump();
+    uint64_t code_va = code_section.GetVA();
+    end = std::min(end, code.size() >= 4 ? code.size() - 3 : 0);
+    for (size_t pos = begin; pos < end; pos++) {
+      uint32_t field;
+      std::memcpy(&field, code.data() + pos, sizeof(field));
+
+      // An immediate of up to 4 bytes may follow a displacement, so the end of the instruction, and
+      // with it a RIP-relative target, can be up to 4 bytes past the field.
+      uint64_t rel_target = code_va + pos + 4 + (int64_t)(int32_t)field;
+      if (rel_target - data_va_ + 4 < data_size_ + 4 || (uint64_t)field - data_va_ < data_size_) {
+        ConfirmRef(decoder, code, code_va, pos, result);
+      }
+    }
+    return result;
+  }
+
+  // Decodes from every start that could hold a 4-byte field at `pos`, farthest first so prefixes are
+  // not cut off, and records the first instruction whose field there addresses a string. Decodes with
+  // a prefix that changes nothing are skipped: such a byte is more likely the end of the previous
+  // instruction, e.g. the 48 of `sub rsp, 48h` in front of `48 8D 0D` (lea rcx, [rip+x]).
+  void ConfirmRef(Decoder& decoder, std::span<const uint8_t> code, uint64_t code_va, size_t pos, std::vector<Ref>& result) const {
+    ZydisDecodedInstruction instruction;
+    ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+    for (size_t start = pos - std::min(pos, kMaxFieldOffset); start < pos; start++) {
+      if (ZYAN_FAILED(decoder.DecodeFull(code.data() + start, code.size() - start, &instruction, operands)) || HasVoidPrefix(instruction)) {
+        continue;
+      }
+
+      size_t offset = pos - start;
+      bool is_disp = instruction.raw.disp.offset == offset && instruction.raw.disp.size == 32;
+      bool is_imm = std::ranges::any_of(instruction.raw.imm, [&](const auto& imm) { return imm.offset == offset && imm.size == 32; });
+      if (!is_disp && !is_imm) {
+        continue;
+      }
+
+      for (ZyanU8 i = 0; i < instruction.operand_count; i++) {
+        const ZydisDecodedOperand& operand = operands[i];
+        uint64_t address;
+        if (is_disp && operand.type == ZYDIS_OPERAND_TYPE_MEMORY) {
+          ZyanU64 absolute;
+          if (ZYAN_FAILED(ZydisCalcAbsoluteAddress(&instruction, &operand, code_va + start, &absolute))) {
+            continue;
+          }
+          address = absolute;
+        } else if (is_imm && operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE && !operand.imm.is_relative) {
+          address = operand.imm.value.u;
+        } else {
+          continue;
+        }
+
+        auto iter = by_address_.find(address);
+        if (iter != by_address_.end()) {
+          result.push_back({iter->second, code_va + start});
+          return;
+        }
+      }
+    }
+  }
+
+  // Prefixes Zydis ignores (a REX that is not last, the earlier of two in one group), an operand size
+  // override under REX.W, and segment overrides other than FS and GS in 64-bit mode.
+  static bool HasVoidPrefix(const ZydisDecodedInstruction& instruction) {
+    for (ZyanU8 i = 0; i < instruction.raw.prefix_count; i++) {
+      const auto& prefix = instruction.raw.prefixes[i];
+      if (prefix.type == ZYDIS_PREFIX_TYPE_IGNORED) {
+        return true;
+      }
+      if (prefix.type != ZYDIS_PREFIX_TYPE_MANDATORY && prefix.value == 0x66 && instruction.raw.rex.W) {
+        return true;
+      }
+      bool is_null_segment = prefix.value == 0x26 || prefix.value == 0x2E || prefix.value == 0x36 || prefix.value == 0x3E;
+      if (is_null_segment && instruction.machine_mode == ZYDIS_MACHINE_MODE_LONG_64) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void LinkRefs(const std::vector<Ref>& refs) {
+    for (const auto& ref : refs) {
+      strings_[ref.string_index].refs.push_back(ref.site);
+    }
+    // Fields are found in order, but the instructions holding them need not be.
+    for (auto& string : strings_) {
+      std::ranges::sort(string.refs);
+      auto [first, last] = std::ranges::unique(string.refs);
+      string.refs.erase(first, last);
+    }
+  }
+
+  uint64_t data_va_;
+  uint64_t data_size_;
+  std::vector<String> strings_;
+  std::unordered_map<std::string, std::vector<uint32_t>> by_text_[2];
+  std::unordered_map<uint64_t, uint32_t> by_address_;
+};
+}  // namespace oph
@@ -0,0 +1,103 @@
+#pragma once
+
+// C++ standard
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace oph {
+// Move-only `void()` callable. Callables up to `kInlineSize` bytes are stored in place, so wrapping
+// a typical pool closure does not allocate; larger ones are moved to the heap.
+class Task {
+ public:
+  static constexpr size_t kInlineSize = 64;
+
+  Task() noexcept : ops_(nullptr) {}
+
+  template <typename Func>
+    requires(!std::is_same_v<std::decay_t<Func>, Task>) && std::is_invocable_v<std::decay_t<Func>&>
+  Task(Func&& func) {
+    using FuncType = std::decay_t<Func>;
+    if constexpr (kFitsInline<FuncType>) {
+      new (storage_) FuncType(std::forward<Func>(func));
+      ops_ = &kInlineOps<FuncType>;
+    } else {
+      *reinterpret_cast<FuncType**>(storage_) = new FuncType(std::forward<Func>(func));
+      ops_ = &kHeapOps<FuncType>;
+    }
+  }
+
+  Task(Task&& other) noexcept : ops_(std::exchange(other.ops_, nullptr)) {
+    if (ops_ != nullptr) {
+      ops_->move(storage_, other.storage_);
+    }
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      ops_ = std::exchange(other.ops_, nullptr);
+      if (ops_ != nullptr) {
+        ops_->move(storage_, other.storage_);
+      }
+    }
+    return *this;
+  }
+
+  ~Task() {
+    Reset();
+  }
+
+  void operator()() {
+    ops_->invoke(storage_);
+  }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+ private:
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  struct Ops {
+    void (*invoke)(std::byte* storage);
+    void (*move)(std::byte* dst, std::byte* src) noexcept;
+    void (*destroy)(std::byte* storage) noexcept;
+  };
+
+  template <typename FuncType>
+  static constexpr bool kFitsInline = sizeof(FuncType) <= kInlineSize &&
+                                      alignof(FuncType) <= alignof(std::max_align_t) &&
+                                      std::is_nothrow_move_constructible_v<FuncType>;
+
+  template <typename FuncType>
+  static constexpr Ops kInlineOps = {
+      [](std::byte* storage) { std::invoke(*std::launder(reinterpret_cast<FuncType*>(storage))); },
+      [](std::byte* dst, std::byte* src) noexcept {
+        auto func = std::launder(reinterpret_cast<FuncType*>(src));
+        new (dst) FuncType(std::move(*func));
+        func->~FuncType();
+      },
+      [](std::byte* storage) noexcept { std::launder(reinterpret_cast<FuncType*>(storage))->~FuncType(); },
+  };
+
+  template <typename FuncType>
+  static constexpr Ops kHeapOps = {
+      [](std::byte* storage) { std::invoke(**reinterpret_cast<FuncType**>(storage)); },
+      [](std::byte* dst, std::byte* src) noexcept { *reinterpret_cast<FuncType**>(dst) = *reinterpret_cast<FuncType**>(src); },
+      [](std::byte* storage) noexcept { delete *reinterpret_cast<FuncType**>(storage); },
+  };
+
+  void Reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) std::byte storage_[kInlineSize];
+  const Ops* ops_;
+};
+}  // namespace oph
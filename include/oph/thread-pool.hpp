@@ -1,36 +1,65 @@
 #pragma once
 
 // C++ standard
+#include <algorithm>
+#include <atomic>
 #include <concepts>
 #include <condition_variable>
+#include <exception>
 #include <functional>
-#include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <thread>
+#include <utility>
 #include <vector>
 
+// This project
+#include "async.hpp"
+#include "future.hpp"
+#include "slab-allocator.hpp"
+#include "task.hpp"
+#include "work-stealing-deque.hpp"
+
 namespace oph {
 class ThreadPool {
  public:
-  ThreadPool(size_t num_threads = std::thread::hardware_concurrency()) {
+  enum ScheduleType {
+    kSharedQueue,
+    kWorkStealing,
+  };
+
+  ThreadPool(size_t num_threads = std::thread::hardware_concurrency(), ScheduleType schedule_type = kSharedQueue)
+      : schedule_type_(schedule_type), slab_(SlabAllocator::Create()) {
+    if (schedule_type_ == kWorkStealing) {
+      local_tasks_.reserve(num_threads);
+      for (size_t i = 0; i < num_threads; i++) {
+        local_tasks_.emplace_back(std::make_unique<WorkStealingDeque<TaskNode>>());
+      }
+    }
+
     workers_.reserve(num_threads);
     for (size_t i = 0; i < num_threads; i++) {
-      workers_.emplace_back([this](std::stop_token stoken) {
-        std::function<void()> task;
+      if (schedule_type_ == kWorkStealing) {
+        workers_.emplace_back([this, i](std::stop_token stoken) { RunStealingWorker(stoken, i); });
+        continue;
+      }
+
+      workers_.emplace_back([this, i](std::stop_token stoken) {
+        current_pool_ = this;
+        current_index_ = i;
+
         for (;;) {
           std::unique_lock<std::mutex> lock(tasks_mutex_);
-          tasks_cv_.wait(lock, [this, &stoken]() { return stoken.stop_requested() || !tasks_.empty(); });
-          if (stoken.stop_requested() && tasks_.empty()) {
+          tasks_cv_.wait(lock, [this, &stoken]() { return stoken.stop_requested() || !tasks_.Empty(); });
+          if (stoken.stop_requested() && tasks_.Empty()) {
             return;
           }
 
-          task = std::move(tasks_.front());
-          tasks_.pop();
+          TaskNode* node = tasks_.Pop();
           lock.unlock();
 
-          task();
+          RunTask(node);
         }
       });
     }
@@ -41,34 +70,35 @@ class ThreadPool {
       worker.request_stop();
     }
     tasks_cv_.notify_all();
+    if (schedule_type_ == kWorkStealing) {
+      std::lock_guard<std::mutex> lock(park_mutex_);
+      park_cv_.notify_all();
+    }
     for (auto& worker : workers_) {
       worker.join();
     }
+    slab_->Unref();
   }
 
   template <typename Callable, typename... Args>
     requires std::is_invocable_v<Callable, Args...>
-  std::future<std::invoke_result_t<Callable, Args...>> Enqueue(Callable&& func, Args&&... args) {
+  Future<std::invoke_result_t<Callable, Args...>> Enqueue(Callable&& func, Args&&... args) {
     using ReturnType = std::invoke_result_t<Callable, Args...>;
 
-    auto promise = std::make_shared<std::promise<ReturnType>>();
-    auto future = promise->get_future();
+    auto [promise, future] = MakePromise<ReturnType>(slab_);
 
-    tasks_mutex_.lock();
-    tasks_.emplace([_func = std::forward<Callable>(func), ... _args = std::forward<Args>(args), _promise = promise]() mutable {
+    Submit([_func = std::forward<Callable>(func), ... _args = std::forward<Args>(args), _promise = std::move(promise)]() mutable {
       try {
         if constexpr (std::is_same_v<ReturnType, void>) {
           std::invoke(_func, std::move(_args)...);
-          _promise->set_value();
+          _promise.SetValue();
         } else {
-          _promise->set_value(std::invoke(_func, std::move(_args)...));
+          _promise.SetValue(std::invoke(_func, std::move(_args)...));
         }
       } catch (...) {
-        _promise->set_exception(std::current_exception());
+        _promise.SetException(std::current_exception());
       }
     });
-    tasks_mutex_.unlock();
-    tasks_cv_.notify_one();
 
     return future;
   }
@@ -78,8 +108,7 @@ class ThreadPool {
   void EnqueueDetach(Callable&& func, Args&&... args) {
     using ReturnType = std::invoke_result_t<Callable, Args...>;
 
-    tasks_mutex_.lock();
-    tasks_.emplace([_func = std::forward<Callable>(func), ... _args = std::forward<Args>(args)]() mutable {
+    Submit([_func = std::forward<Callable>(func), ... _args = std::forward<Args>(args)]() mutable {
       try {
         if constexpr (std::is_same_v<ReturnType, void>) {
           std::invoke(_func, std::move(_args)...);
@@ -89,19 +118,353 @@ class ThreadPool {
       } catch (...) {
       }
     });
-    tasks_mutex_.unlock();
-    tasks_cv_.notify_one();
+  }
+
+  // `co_await pool.Schedule()` moves the awaiting coroutine onto a worker of this pool.
+  auto Schedule() noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept { return false; }
+
+      void await_suspend(std::coroutine_handle<> handle) {
+        pool->Submit([handle]() { handle.resume(); });
+      }
+
+      void await_resume() noexcept {}
+
+      ThreadPool* pool;
+    };
+    return Awaiter{this};
+  }
+
+  // Starts `async` on this pool. While it waits on sub-scans or futures it gives its worker back,
+  // so deep chains of dependent scans can run on a small pool without deadlocking it.
+  template <typename T>
+  Future<T> Spawn(Async<T> async) {
+    auto [promise, future] = MakePromise<T>(slab_);
+    DriveAsync(std::move(async), std::move(promise));
+    return future;
+  }
+
+  // Runs every element of `asyncs` concurrently on this pool and resumes with their results in order.
+  template <typename T>
+    requires(!std::is_void_v<T>)
+  Async<std::vector<T>> WhenAll(std::vector<Async<T>> asyncs) {
+    std::vector<Future<T>> futures;
+    futures.reserve(asyncs.size());
+    for (auto& async : asyncs) {
+      futures.push_back(Spawn(std::move(async)));
+    }
+
+    std::vector<T> results;
+    results.reserve(futures.size());
+    for (auto& future : futures) {
+      results.push_back(co_await std::move(future));
+    }
+    co_return results;
+  }
+
+  // Calls `func(i)` for every i in [begin, end), or `func(chunk_begin, chunk_end)` once per chunk.
+  // Chunks start large and shrink towards `grain` as the range runs out, and the calling thread works
+  // through them alongside the pool, so this is safe to call from inside a pool task. The first
+  // exception thrown by `func` stops further chunks from starting and is rethrown here.
+  template <typename Func>
+    requires std::is_invocable_v<Func&, size_t> || std::is_invocable_v<Func&, size_t, size_t>
+  void ParallelFor(size_t begin, size_t end, size_t grain, Func&& func) {
+    RunParallel(begin, end, grain, [&func](size_t chunk_begin, size_t chunk_end) {
+      if constexpr (std::is_invocable_v<Func&, size_t, size_t>) {
+        std::invoke(func, chunk_begin, chunk_end);
+      } else {
+        for (size_t i = chunk_begin; i < chunk_end; i++) {
+          std::invoke(func, i);
+        }
+      }
+    });
+  }
+
+  // Maps every chunk of [begin, end) to a partial result, with `map(chunk_begin, chunk_end)` or by
+  // folding `map(i)` with `combine`, then folds the partials into `init` in index order. `combine`
+  // must be associative but need not be commutative. Scheduling is the same as ParallelFor.
+  template <typename T, typename MapFunc, typename CombineFunc>
+    requires(std::is_invocable_r_v<T, MapFunc&, size_t> || std::is_invocable_r_v<T, MapFunc&, size_t, size_t>) &&
+            std::is_invocable_r_v<T, CombineFunc&, T, T>
+  T ParallelReduce(size_t begin, size_t end, size_t grain, T init, MapFunc&& map, CombineFunc&& combine) {
+    std::vector<std::pair<size_t, T>> partials;
+    std::mutex partials_mutex;
+
+    RunParallel(begin, end, grain, [&](size_t chunk_begin, size_t chunk_end) {
+      auto partial = [&]() -> T {
+        if constexpr (std::is_invocable_r_v<T, MapFunc&, size_t, size_t>) {
+          return std::invoke(map, chunk_begin, chunk_end);
+        } else {
+          T value = std::invoke(map, chunk_begin);
+          for (size_t i = chunk_begin + 1; i < chunk_end; i++) {
+            value = std::invoke(combine, std::move(value), std::invoke(map, i));
+          }
+          return value;
+        }
+      }();
+
+      std::lock_guard<std::mutex> lock(partials_mutex);
+      partials.emplace_back(chunk_begin, std::move(partial));
+    });
+
+    std::ranges::sort(partials, {}, &std::pair<size_t, T>::first);
+    for (auto& [chunk_begin, partial] : partials) {
+      init = std::invoke(combine, std::move(init), std::move(partial));
+    }
+    return init;
+  }
+
+  size_t GetNumThreads() const { return workers_.size(); }
+
+  ScheduleType GetScheduleType() const { return schedule_type_; }
+
+  // Index of the calling thread among the workers of this pool, or nullopt if it is not one of them.
+  std::optional<size_t> GetWorkerIndex() const {
+    if (current_pool_ != this) {
+      return std::nullopt;
+    }
+    return current_index_;
   }
 
  private:
+  struct TaskNode {
+    Task task;
+    TaskNode* next = nullptr;
+  };
+
+  // Intrusive FIFO over slab-allocated nodes, so queueing a task never allocates.
+  class TaskList {
+   public:
+    bool Empty() const { return head_ == nullptr; }
+
+    void Push(TaskNode* node) {
+      if (tail_ != nullptr) {
+        tail_->next = node;
+      } else {
+        head_ = node;
+      }
+      tail_ = node;
+    }
+
+    TaskNode* Pop() {
+      TaskNode* node = head_;
+      if (node != nullptr) {
+        head_ = node->next;
+        if (head_ == nullptr) {
+          tail_ = nullptr;
+        }
+      }
+      return node;
+    }
+
+   private:
+    TaskNode* head_ = nullptr;
+    TaskNode* tail_ = nullptr;
+  };
+
+  template <typename T>
+  DetachedAsync DriveAsync(Async<T> async, Promise<T> promise) {
+    co_await Schedule();
+    try {
+      if constexpr (std::is_void_v<T>) {
+        co_await std::move(async);
+        promise.SetValue();
+      } else {
+        promise.SetValue(co_await std::move(async));
+      }
+    } catch (...) {
+      promise.SetException(std::current_exception());
+    }
+  }
+
+  // Chunk bookkeeping of one ParallelFor/ParallelReduce call. Helper tasks hold a reference, so one
+  // that starts after the call has returned only finds the range exhausted and leaves.
+  struct ParallelRange {
+    ParallelRange(size_t begin, size_t end, size_t grain, size_t num_participants)
+        : next(begin), end(end), grain(std::max<size_t>(grain, 1)), num_participants(num_participants) {}
+
+    bool Claim(size_t& chunk_begin, size_t& chunk_end) {
+      size_t current = next.load();
+      size_t chunk_size;
+      do {
+        if (current >= end) {
+          return false;
+        }
+        chunk_size = std::min(std::max(grain, (end - current) / (num_participants * 2)), end - current);
+      } while (!next.compare_exchange_weak(current, current + chunk_size));
+
+      chunk_begin = current;
+      chunk_end = current + chunk_size;
+      return true;
+    }
+
+    template <typename ChunkFunc>
+    void Run(ChunkFunc& chunk_func) {
+      size_t chunk_begin, chunk_end;
+      while (Claim(chunk_begin, chunk_end)) {
+        try {
+          chunk_func(chunk_begin, chunk_end);
+        } catch (...) {
+          if (!failed.exchange(true)) {
+            exception = std::current_exception();
+          }
+          next.store(end);
+        }
+      }
+    }
+
+    std::atomic_size_t next;
+    const size_t end;
+    const size_t grain;
+    const size_t num_participants;
+    std::atomic_uint32_t num_active = 0;
+    std::atomic_bool failed = false;
+    std::exception_ptr exception;
+  };
+
+  template <typename ChunkFunc>
+  void RunParallel(size_t begin, size_t end, size_t grain, ChunkFunc&& chunk_func) {
+    if (begin >= end) {
+      return;
+    }
+
+    size_t num_chunks = (end - begin + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1);
+    size_t num_helpers = std::min(workers_.size(), num_chunks - 1);
+    auto range = std::make_shared<ParallelRange>(begin, end, grain, num_helpers + 1);
+
+    for (size_t i = 0; i < num_helpers; i++) {
+      Submit([range, chunk_func = &chunk_func]() {
+        // A helper registers before it claims, so the caller below cannot miss a chunk in flight.
+        range->num_active.fetch_add(1);
+        range->Run(*chunk_func);
+        if (range->num_active.fetch_sub(1) == 1) {
+          range->num_active.notify_all();
+        }
+      });
+    }
+
+    range->Run(chunk_func);
+    for (uint32_t num_active; (num_active = range->num_active.load()) != 0;) {
+      range->num_active.wait(num_active);
+    }
+
+    if (range->failed.load()) {
+      std::rethrow_exception(range->exception);
+    }
+  }
+
+  // Idle work-stealing workers retry this many times before parking on `park_cv_`.
+  static constexpr size_t kSpinCount = 64;
+
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool(ThreadPool&&) noexcept = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
   ThreadPool& operator=(ThreadPool&&) noexcept = delete;
 
+  void Submit(Task&& task) {
+    auto node = slab_->New<TaskNode>(std::move(task));
+
+    if (schedule_type_ == kSharedQueue) {
+      tasks_mutex_.lock();
+      tasks_.Push(node);
+      tasks_mutex_.unlock();
+      tasks_cv_.notify_one();
+      return;
+    }
+
+    // Counted before it is published, so a worker that takes it can never see the counter underflow.
+    num_pending_.fetch_add(1);
+
+    if (current_pool_ == this) {
+      local_tasks_[current_index_]->Push(node);
+    } else {
+      injected_tasks_mutex_.lock();
+      injected_tasks_.Push(node);
+      injected_tasks_mutex_.unlock();
+    }
+
+    if (num_parked_.load() > 0) {
+      std::lock_guard<std::mutex> lock(park_mutex_);
+      park_cv_.notify_one();
+    }
+  }
+
+  void RunTask(TaskNode* node) {
+    node->task();
+    slab_->Delete(node);
+  }
+
+  TaskNode* FindTask(size_t index) {
+    if (auto node = local_tasks_[index]->Pop(); node != nullptr) {
+      return node;
+    }
+
+    if (injected_tasks_mutex_.try_lock()) {
+      TaskNode* node = injected_tasks_.Pop();
+      injected_tasks_mutex_.unlock();
+      if (node != nullptr) {
+        return node;
+      }
+    }
+
+    size_t num_threads = local_tasks_.size();
+    for (size_t i = 1; i < num_threads; i++) {
+      if (auto node = local_tasks_[(index + i) % num_threads]->Steal(); node != nullptr) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  void RunStealingWorker(std::stop_token stoken, size_t index) {
+    current_pool_ = this;
+    current_index_ = index;
+
+    for (;;) {
+      TaskNode* node = nullptr;
+      for (size_t i = 0; i < kSpinCount && node == nullptr; i++) {
+        if (num_pending_.load(std::memory_order_relaxed) > 0) {
+          node = FindTask(index);
+        }
+        if (node == nullptr) {
+          std::this_thread::yield();
+        }
+      }
+
+      if (node != nullptr) {
+        num_pending_.fetch_sub(1);
+        RunTask(node);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(park_mutex_);
+      num_parked_.fetch_add(1);
+      park_cv_.wait(lock, [this, &stoken]() { return stoken.stop_requested() || num_pending_.load() > 0; });
+      num_parked_.fetch_sub(1);
+      if (stoken.stop_requested() && num_pending_.load() == 0) {
+        return;
+      }
+    }
+  }
+
+  const ScheduleType schedule_type_;
+  SlabAllocator* slab_;
   std::vector<std::jthread> workers_;
-  std::queue<std::function<void()>> tasks_;
+
+  TaskList tasks_;
   std::mutex tasks_mutex_;
   std::condition_variable tasks_cv_;
+
+  std::vector<std::unique_ptr<WorkStealingDeque<TaskNode>>> local_tasks_;
+  TaskList injected_tasks_;
+  std::mutex injected_tasks_mutex_;
+  std::atomic_size_t num_pending_ = 0;
+  std::atomic_size_t num_parked_ = 0;
+  std::mutex park_mutex_;
+  std::condition_variable park_cv_;
+
+  static inline thread_local ThreadPool* current_pool_ = nullptr;
+  static inline thread_local size_t current_index_ = 0;
 };
 }  // namespace oph
@@ -0,0 +1,270 @@
+#pragma once
+
+// C++ standard
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <vector>
+
+// This project
+#include "cancellation.hpp"
+#include "memory.hpp"
+#include "scan-stats.hpp"
+#include "thread-pool.hpp"
+
+// Widest instruction set ValueScanner uses: 2 for AVX2, 1 for SSE2, 0 for none. SSE2 is part of
+// x86-64; AVX2 is used when the compiler targets it (e.g. /arch:AVX2, -mavx2).
+#ifndef OPH_VALUE_SCANNER_SIMD
+#if defined(__AVX2__)
+#define OPH_VALUE_SCANNER_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OPH_VALUE_SCANNER_SIMD 1
+#else
+#define OPH_VALUE_SCANNER_SIMD 0
+#endif
+#endif
+
+#if OPH_VALUE_SCANNER_SIMD > 0
+#include <immintrin.h>
+#endif
+
+namespace oph {
+// Finds every aligned `T` in a buffer that equals a value, lies in a range or belongs to a set, e.g.
+// the pointers into .text that make up vtables and function tables in .rdata. Every predicate is
+// tested as one unsigned range check, `value - lo <= hi - lo`, several lanes at a time; sets are
+// first narrowed to the range of their members and only the hits are looked up.
+template <typename T>
+  requires std::same_as<T, uint32_t> || std::same_as<T, uint64_t>
+class ValueScanner {
+ public:
+  static ValueScanner Equal(T value) {
+    return ValueScanner(value, value, {});
+  }
+
+  // [begin, end)
+  static ValueScanner Range(T begin, T end) {
+    if (begin >= end) {
+      throw std::runtime_error(std::format("oph/value-scanner: empty range: [{:x}, {:x})", begin, end));
+    }
+    return ValueScanner(begin, end - 1, {});
+  }
+
+  // [first, last], so that a range can end at the largest `T`.
+  static ValueScanner RangeInclusive(T first, T last) {
+    if (first > last) {
+      throw std::runtime_error(std::format("oph/value-scanner: empty range: [{:x}, {:x}]", first, last));
+    }
+    return ValueScanner(first, last, {});
+  }
+
+  // Pointers to anywhere in `section`, as it was mapped when it was dumped. Throws if a `T` cannot
+  // hold every address in it, e.g. 32-bit values and a section above 4 GB.
+  static ValueScanner PointsInto(const Section& section) {
+    uint64_t va = section.GetVA(), size = section.GetDump().size();
+    if (size == 0) {
+      throw std::runtime_error(std::format("oph/value-scanner: empty range: [{:x}, {:x})", va, va));
+    }
+    if (va > std::numeric_limits<T>::max() || size - 1 > std::numeric_limits<T>::max() - va) {
+      throw std::runtime_error(std::format("oph/value-scanner: section that does not fit in {}-bit values: [{:x}, {:x})", sizeof(T) * 8, va, va + size));
+    }
+    return RangeInclusive((T)va, (T)(va + size - 1));
+  }
+
+  static ValueScanner Set(std::vector<T> values) {
+    if (values.empty()) {
+      throw std::runtime_error("oph/value-scanner: empty set");
+    }
+    std::ranges::sort(values);
+    auto [first, last] = std::ranges::unique(values);
+    values.erase(first, last);
+    T lo = values.front(), hi = values.back();
+    return ValueScanner(lo, hi, std::move(values));
+  }
+
+  // Only values at a multiple of `alignment` from the base address are looked at. Defaults to
+  // sizeof(T); smaller alignments, down to 1, find unaligned values as well.
+  ValueScanner& Align(size_t alignment) {
+    if (!std::has_single_bit(alignment)) {
+      throw std::runtime_error(std::format("oph/value-scanner: alignment that is not a power of two: {}", alignment));
+    }
+    alignment_ = alignment;
+    return *this;
+  }
+
+  // Offsets of the matches plus `base_addr`, in ascending order.
+  std::vector<uint64_t> Search(std::span<const uint8_t> buffer, uint64_t base_addr = 0) const {
+    return Search(buffer, std::stop_token(), 0, buffer.size(), base_addr);
+  }
+
+  // Only reports matches starting in [begin, end), like SigSet::Search, and throws Cancelled once
+  // `stoken` is triggered.
+  std::vector<uint64_t> Search(std::span<const uint8_t> buffer, std::stop_token stoken, size_t begin, size_t end, uint64_t base_addr = 0) const {
+    std::vector<uint64_t> result;
+
+    end = std::min(end, buffer.size() >= sizeof(T) ? buffer.size() - sizeof(T) + 1 : 0);
+    if (begin >= end) {
+      return result;
+    }
+
+    // Positions `stride` apart are contiguous values. Alignments below sizeof(T) take one pass per
+    // phase and merge them.
+    size_t stride = std::max(alignment_, sizeof(T));
+    size_t num_phases = stride / alignment_;
+    size_t first = begin + (alignment_ - (base_addr + begin) % alignment_) % alignment_;
+    uint64_t num_candidates = 0;
+    for (size_t phase = 0; phase < num_phases; phase++) {
+      size_t start = first + phase * alignment_;
+      if (start >= end) {
+        break;
+      }
+
+      const uint8_t* ptr = buffer.data() + start;
+      size_t count = (end - start + stride - 1) / stride;
+      auto on_candidate = [&](size_t index) {
+        num_candidates++;
+        if (!set_.empty() && !std::ranges::binary_search(set_, Load(ptr + index * stride))) {
+          return;
+        }
+        result.push_back(base_addr + start + index * stride);
+      };
+
+      for (size_t block = 0; block < count; block += kStopCheckInterval) {
+        ThrowIfStopRequested(stoken);
+
+        size_t block_count = std::min(count - block, kStopCheckInterval);
+        if (stride == sizeof(T)) {
+          ScanContiguous(ptr + block * stride, block_count, [&](size_t index) { on_candidate(block + index); });
+        } else {
+          for (size_t i = block; i < block + block_count; i++) {
+            if (InRange(Load(ptr + i * stride))) {
+              on_candidate(i);
+            }
+          }
+        }
+      }
+    }
+    if (num_phases > 1) {
+      std::ranges::sort(result);
+    }
+
+    ScanStatsScope::Record(end - begin, num_candidates);
+    return result;
+  }
+
+  // Splits `buffer` into chunks searched concurrently on `pool`.
+  std::vector<uint64_t> Search(ThreadPool& pool, std::span<const uint8_t> buffer, uint64_t base_addr = 0) const {
+    return Search(pool, buffer, std::stop_token(), base_addr);
+  }
+
+  std::vector<uint64_t> Search(ThreadPool& pool, std::span<const uint8_t> buffer, std::stop_token stoken, uint64_t base_addr = 0) const {
+    return pool.ParallelReduce(
+        0, buffer.size(), kParallelGrain, std::vector<uint64_t>(),
+        [&](size_t begin, size_t end) { return Search(buffer, stoken, begin, end, base_addr); },
+        [](std::vector<uint64_t> lhs, std::vector<uint64_t> rhs) {
+          lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+          return lhs;
+        });
+  }
+
+ private:
+  static constexpr size_t kStopCheckInterval = 1 << 16;
+  static constexpr size_t kParallelGrain = 1 << 20;
+
+  ValueScanner(T lo, T hi, std::vector<T>&& set) : lo_(lo), hi_(hi), set_(std::move(set)) {}
+
+  static T Load(const uint8_t* ptr) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+  }
+
+  bool InRange(T value) const {
+    return (T)(value - lo_) <= (T)(hi_ - lo_);
+  }
+
+  // Calls `on_candidate(i)` for every i < `count` such that the `i`th value at `ptr` is in range.
+  // Loads are unaligned, so `ptr` can be at any phase.
+  template <typename Func>
+  void ScanContiguous(const uint8_t* ptr, size_t count, Func&& on_candidate) const {
+    size_t i = 0;
+    auto report = [&](uint32_t mask, size_t base) {
+      for (; mask != 0; mask &= mask - 1) {
+        on_candidate(base + std::countr_zero(mask));
+      }
+    };
+
+#if OPH_VALUE_SCANNER_SIMD >= 2
+    {
+      constexpr size_t kLanes = sizeof(__m256i) / sizeof(T);
+      const __m256i lo = Broadcast256(lo_);
+      // Unsigned compares are signed compares with the sign bits flipped.
+      const __m256i bias = Broadcast256((T)1 << (sizeof(T) * 8 - 1));
+      const __m256i span = _mm256_xor_si256(Broadcast256((T)(hi_ - lo_)), bias);
+      for (; i + kLanes <= count; i += kLanes) {
+        __m256i value = _mm256_loadu_si256((const __m256i*)(ptr + i * sizeof(T)));
+        __m256i offset = _mm256_xor_si256(Sub256(value, lo), bias);
+        if constexpr (sizeof(T) == 4) {
+          uint32_t above = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(offset, span)));
+          report(~above & 0xFF, i);
+        } else {
+          uint32_t above = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(offset, span)));
+          report(~above & 0xF, i);
+        }
+      }
+    }
+#endif
+
+#if OPH_VALUE_SCANNER_SIMD >= 1
+    // SSE2 has no 64-bit compare, and emulating one costs more than the scalar loop below.
+    if constexpr (sizeof(T) == 4) {
+      constexpr size_t kLanes = sizeof(__m128i) / sizeof(T);
+      const __m128i lo = _mm_set1_epi32((int)lo_);
+      const __m128i bias = _mm_set1_epi32((int)0x80000000);
+      const __m128i span = _mm_xor_si128(_mm_set1_epi32((int)(hi_ - lo_)), bias);
+      for (; i + kLanes <= count; i += kLanes) {
+        __m128i value = _mm_loadu_si128((const __m128i*)(ptr + i * sizeof(T)));
+        __m128i offset = _mm_xor_si128(_mm_sub_epi32(value, lo), bias);
+        uint32_t above = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(offset, span)));
+        report(~above & 0xF, i);
+      }
+    }
+#endif
+
+    for (; i < count; i++) {
+      if (InRange(Load(ptr + i * sizeof(T)))) {
+        on_candidate(i);
+      }
+    }
+  }
+
+#if OPH_VALUE_SCANNER_SIMD >= 2
+  static __m256i Broadcast256(T value) {
+    if constexpr (sizeof(T) == 4) {
+      return _mm256_set1_epi32((int)value);
+    } else {
+      return _mm256_set1_epi64x((long long)value);
+    }
+  }
+
+  static __m256i Sub256(__m256i lhs, __m256i rhs) {
+    if constexpr (sizeof(T) == 4) {
+      return _mm256_sub_epi32(lhs, rhs);
+    } else {
+      return _mm256_sub_epi64(lhs, rhs);
+    }
+  }
+#endif
+
+  T lo_;
+  T hi_;
+  std::vector<T> set_;
+  size_t alignment_ = sizeof(T);
+};
+}  // namespace oph
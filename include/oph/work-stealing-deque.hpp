@@ -0,0 +1,120 @@
+#pragma once
+
+// C++ standard
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace oph {
+// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+// Push and Pop may only be called by the owner thread, Steal may be called by any thread.
+template <typename T>
+class WorkStealingDeque {
+ public:
+  WorkStealingDeque(size_t capacity = 256) : top_(0), bottom_(0) {
+    size_t size = 1;
+    for (; size < capacity; size <<= 1);
+
+    auto array = std::make_unique<Array>(size);
+    array_.store(array.get(), std::memory_order_relaxed);
+    arrays_.push_back(std::move(array));
+  }
+
+  void Push(T* item) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > array->Capacity() - 1) {
+      array = Grow(array, top, bottom);
+    }
+
+    array->Put(bottom, item);
+    bottom_.store(bottom + 1, std::memory_order_release);
+  }
+
+  T* Pop() {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    T* item = array->Get(bottom);
+    if (top == bottom) {
+      if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  T* Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+    if (top >= bottom) {
+      return nullptr;
+    }
+
+    Array* array = array_.load(std::memory_order_acquire);
+    T* item = array->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  bool Empty() const {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    return top >= bottom;
+  }
+
+ private:
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque(WorkStealingDeque&&) noexcept = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(WorkStealingDeque&&) noexcept = delete;
+
+  class Array {
+   public:
+    Array(size_t capacity) : mask_(capacity - 1), items_(std::make_unique<std::atomic<T*>[]>(capacity)) {}
+
+    int64_t Capacity() const { return mask_ + 1; }
+
+    T* Get(int64_t index) const { return items_[index & mask_].load(std::memory_order_relaxed); }
+
+    void Put(int64_t index, T* item) { items_[index & mask_].store(item, std::memory_order_relaxed); }
+
+   private:
+    int64_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> items_;
+  };
+
+  Array* Grow(Array* array, int64_t top, int64_t bottom) {
+    auto new_array = std::make_unique<Array>(array->Capacity() * 2);
+    for (int64_t i = top; i != bottom; i++) {
+      new_array->Put(i, array->Get(i));
+    }
+
+    // Thieves may still be reading the old array, so it is kept alive until the deque goes away.
+    Array* result = new_array.get();
+    array_.store(result, std::memory_order_release);
+    arrays_.push_back(std::move(new_array));
+    return result;
+  }
+
+  alignas(64) std::atomic<int64_t> top_;
+  alignas(64) std::atomic<int64_t> bottom_;
+  alignas(64) std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_;
+};
+}  // namespace oph
@@ -1,5 +1,6 @@
 #include "oph/memory.hpp"
 
+#ifdef _WIN32
 namespace oph {
 std::string DumpStore::GetFileVersion(std::string_view file_path) {
   std::string version;
@@ -26,3 +27,4 @@ std::string DumpStore::GetFileVersion(std::string_view file_path) {
   return version;
 }
 }  // namespace oph
+#endif  // _WIN32